@@ -0,0 +1,127 @@
+// Confronto fra AST originale (nodi sparsi nello heap, visita con chiamate
+// virtuali) e AST compatto (flatast.hpp) su un programma generato di grandi
+// dimensioni. Vengono misurati:
+//  - la costruzione dell'AST compatto (una visita completa dell'AST originale);
+//  - una visita completa di ciascuna rappresentazione che conta i nodi
+//    (RootAST::countNodes e FlatCount), senza generare codice;
+//  - come riferimento, la generazione dell'IR dall'AST originale, in un
+//    modulo nuovo ad ogni ripetizione (senza stampa).
+// Uso: flatbench [file.k [ripetizioni]]
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include "../flatast.hpp"
+
+// Programma sintetico: molte funzioni con corpi lunghi, cicli, blocchi,
+// condizionali e chiamate. I contatori dei cicli hanno nomi diversi in ogni
+// funzione, perché la tabella dei simboli conserva quelli delle precedenti
+static std::string synth (const std::string& path, int nfun)
+{
+  std::ofstream os(path);
+  os << "extern sqrt(x);\n";
+  for (int i=0; i<nfun; i++) {
+    os << "def fun" << i << "(a b c) {\n"
+       << "  var acc = 0; var t = a * b - c;\n";
+    for (int j=0; j<8; j++)
+      os << "  for (var i" << i << "_" << j << " = 0; i" << i << "_" << j << " < a and t < 1000; ++i" << i << "_" << j << ") {\n"
+         << "    var u = acc * 0.5 + t / (b + 1) - c * 3;\n"
+         << "    acc = acc + (u < 0 ? -u : u) + " << j << ";\n"
+         << "    t = t + sqrt(acc * acc + 1) - b * (c - a) / 7\n"
+         << "  };\n";
+    os << "  acc + t" << (i ? " + fun" + std::to_string(i-1) + "(a, b, c)" : "") << "\n"
+       << "};\n";
+  }
+  return path;
+}
+
+// Visita completa dell'AST compatto: conta i nodi raggiungibili
+class FlatCount : public FlatVisitor<FlatCount, uint64_t> {
+public:
+  using FlatVisitor::FlatVisitor;
+  uint64_t run() {
+    uint64_t n = 0;
+    for (uint32_t t : ast.top)
+      n += visit(t);
+    return n;
+  };
+  uint64_t children(const FlatNode& N) {
+    return 1 + (N.a != FlatAST::None ? visit(N.a) : 0)
+             + (N.b != FlatAST::None ? visit(N.b) : 0)
+             + (N.c != FlatAST::None ? visit(N.c) : 0);
+  };
+  uint64_t elems(uint32_t list) {
+    uint64_t n = 0;
+    for (uint32_t i=0; i<ast.size(list); i++)
+      n += visit(ast.elem(list, i));
+    return n;
+  };
+  uint64_t visitNumber(const FlatNode& N) { return 1; };
+  uint64_t visitVariable(const FlatNode& N) { return 1; };
+  uint64_t visitNeg(const FlatNode& N) { return 1 + visit(N.a); };
+  uint64_t visitBinary(const FlatNode& N) { return children(N); };
+  uint64_t visitCall(const FlatNode& N) { return 1 + elems(N.b); };
+  uint64_t visitIf(const FlatNode& N) { return children(N); };
+  uint64_t visitNot(const FlatNode& N) { return 1 + visit(N.a); };
+  uint64_t visitCond(const FlatNode& N) { return children(N); };
+  uint64_t visitBlock(const FlatNode& N) { return 1 + elems(N.a) + visit(N.b); };
+  uint64_t visitBinding(const FlatNode& N) { return 1 + visit(N.b); };
+  uint64_t visitStmt(const FlatNode& N) { return children(N); };
+  uint64_t visitAssign(const FlatNode& N) { return 1 + visit(N.b); };
+  uint64_t visitIncrement(const FlatNode& N) { return 1; };
+  uint64_t visitFor(const FlatNode& N) { return 1 + visit(N.a) + elems(N.b); };
+  uint64_t visitFunction(const FlatNode& N) { return 1 + visit(N.c); };
+  uint64_t visitExtern(const FlatNode& N) { return 1; };
+  uint64_t visitGlobal(const FlatNode& N) { return 1; };
+  uint64_t visitFallback(const FlatNode& N) { return 1; };
+};
+
+template <typename F>
+static double best (int reps, F f)
+{
+  double b = 1e30;
+  for (int r=0; r<reps; r++) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+    b = std::min(b, secs.count());
+  }
+  return b * 1e3;
+}
+
+int
+main (int argc, char *argv[])
+{
+  std::string file = argc > 1 ? argv[1] : synth("/tmp/flatbench.k", 5000);
+  int reps = argc > 2 ? atoi(argv[2]) : 5;
+
+  driver drv;
+  if (drv.parse(file))
+    return 1;
+
+  FlatAST flat(drv.root);
+  uint64_t count = 0, ptrcount = 0;
+  double tflatten = best(reps, [&]() { FlatAST f(drv.root); });
+  double tptrwalk = best(reps, [&]() { ptrcount = drv.root->countNodes(); });
+  double twalk = best(reps, [&]() { count = FlatCount(flat).run(); });
+  if (count != ptrcount)
+    std::cerr << "visite diverse: " << ptrcount << " nodi nell'AST originale\n";
+
+  // Ogni ripetizione usa un driver (e quindi un modulo) nuovo; emit_module
+  // evita la stampa delle singole definizioni
+  double tgen = best(reps, [&]() {
+    driver g;
+    g.emit_module = true;
+    g.diag = &nulls();
+    drv.root->codegen(g);
+  });
+
+  std::cout << file << ": " << count << " nodi, " << flat.nodes.size() * sizeof(FlatNode) / 1024
+            << " KB di nodi compatti (" << flat.fallbacks.size() << " rinvii)\n"
+            << "costruzione AST compatto: " << tflatten << " ms\n"
+            << "visita AST originale:     " << tptrwalk << " ms\n"
+            << "visita AST compatto:      " << twalk << " ms (" << tptrwalk / twalk << "x)\n"
+            << "codegen AST originale:    " << tgen << " ms\n"
+            << "(migliore su " << reps << " ripetizioni)\n";
+  return 0;
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+# Overhead di kcomp -finstrument: profbench.k viene compilato con e senza
+# strumentazione (llc -O2) ed eseguito più volte; si confrontano le mediane.
+# La terza misura strumenta solo le funzioni di almeno MIN istruzioni IR.
+# Uso (dalla directory principale, dopo make): bench/profbench.sh [ripetizioni [MIN]]
+set -e
+REPS=${1:-9}
+MIN=${2:-20}
+BIN=$(llvm-config-16 --bindir)
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+build () {  # build <nome> <opzioni kcomp>
+  ./kcomp $2 bench/profbench.k 2> "$DIR/$1.ll"
+  "$BIN/llc" -O2 -relocation-model=pic -filetype=obj "$DIR/$1.ll" -o "$DIR/$1.o"
+  cc -O2 bench/profbench_main.c "$DIR/$1.o" libkprof.a -lstdc++ -o "$DIR/$1"
+}
+
+median () {  # median <eseguibile>
+  for i in $(seq "$REPS"); do
+    KPROF_OUT=/dev/null taskset -c 0 "$1"
+  done | sort -n | awk '{ t[NR] = $1 } END { print t[int((NR + 1) / 2)] }'
+}
+
+build plain ""
+build instr "-finstrument"
+build min "-finstrument=$MIN"
+PLAIN=$(median "$DIR/plain")
+INSTR=$(median "$DIR/instr")
+MINT=$(median "$DIR/min")
+echo "senza strumentazione: ${PLAIN}s"
+echo "con -finstrument:     ${INSTR}s"
+awk -v a="$PLAIN" -v b="$INSTR" 'BEGIN { printf "overhead:             %.1f%%\n", 100 * (b - a) / a }'
+echo "con -finstrument=$MIN:  ${MINT}s"
+awk -v a="$PLAIN" -v b="$MINT" 'BEGIN { printf "overhead:             %.1f%%\n", 100 * (b - a) / a }'
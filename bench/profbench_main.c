@@ -0,0 +1,24 @@
+/* Driver C per profbench.k: misura il tempo delle funzioni Kaleidoscope */
+#include <stdio.h>
+#include <time.h>
+
+double fib(double);
+double sumsq(double);
+double nested(double);
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void) {
+  double start = now(), r = 0;
+  for (int i = 0; i < 20; i++) {
+    r += fib(24);           /* molte chiamate brevi: caso peggiore */
+    r += sumsq(1000000);    /* ciclo lungo senza chiamate */
+    r += nested(300);       /* cicli annidati con chiamate */
+  }
+  printf("%.6f\n", now() - start);
+  return r == 0;
+}
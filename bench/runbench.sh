@@ -0,0 +1,180 @@
+#!/bin/sh
+# Prestazioni del codice generato da kcomp. Ogni programma di bench/runbench
+# (ricorsione, cicli annidati, condizionali, variabili globali, funzioni
+# della libreria matematica) definisce bench(), scritta in Kaleidoscope
+# (.k) e in C (.c, il riferimento, compilato con cc -O2). Il programma
+# Kaleidoscope viene compilato in ogni modalità di kcomp e ottimizzato con
+# opt e llc a ogni livello; con -flto, che ottimizza già il modulo (-O2) al
+# collegamento, solo con llc -O2 (livello "lto"). Con -run è invece eseguito
+# a livelli (tiered.hpp, il tempo comprende parsing e compilazione JIT). Ogni
+# eseguibile gira più volte sullo stesso core (-run su due, perché il
+# compilatore JIT ha un thread proprio): si riportano la mediana e il
+# rapporto con il C.
+# Le altre opzioni di kcomp hanno una modalità propria: -flto=thin (bitcode
+# già ottimizzato per il collegamento, completato da opt con la pipeline
+# ThinLTO; con un solo file non ci sono funzioni da importare), -g (le
+# informazioni di debug non devono cambiare il codice) e -finstrument
+# (collegato con libkprof.a, report scartato). Le ultime due sono misurate
+# solo a -O2: agli altri livelli non dicono nulla in più di plain.
+# Un risultato di bench() diverso da quello del C è un errore (uscita 1), e
+# così un rapporto con il C oltre quello di bench/runbench.base (programma,
+# modalità, livello e rapporto su ogni riga) di più del 50%: una regressione
+# del codice generato fa fallire lo script. Il rapporto dipende dal
+# programma (il C di fib è molto più veloce di qualunque modalità), per cui
+# non c'è un'unica soglia. Per il confronto ogni eseguibile gira alternato
+# con il C e si usa il rapporto fra i tempi minimi, meno sensibili al carico
+# della macchina e alle sue variazioni durante lo script delle mediane
+# (TOLERANCE=1.25 restringe il margine). Con -u i rapporti misurati
+# sostituiscono quelli di bench/runbench.base, da rigenerare su una
+# macchina o una versione di LLVM diverse. L'esecuzione a livelli, che
+# comprende la compilazione (e dipende quindi da come è compilato kcomp),
+# non è confrontata.
+# Uso (dalla directory principale, dopo make): bench/runbench.sh [-u] [ripetizioni]
+set -e
+UPDATE=0
+if [ "$1" = -u ]; then
+  UPDATE=1
+  shift
+fi
+REPS=${1:-5}
+BASE=bench/runbench.base
+TOLERANCE=${TOLERANCE:-1.5}
+BIN=$(llvm-config-16 --bindir)
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+PROGS="fib loops branch globals math"
+MODES="plain ssa fold ssa+fold lto thin g instr"
+LEVELS="0 1 2 3"
+STATUS=0
+export KPROF_OUT=/dev/null
+
+options () {  # options <modalità>: opzioni kcomp corrispondenti
+  case $1 in
+    plain) echo "" ;;
+    ssa) echo "-fssa" ;;
+    fold) echo "-ffold" ;;
+    ssa+fold) echo "-fssa -ffold" ;;
+    lto) echo "-flto -export bench" ;;
+    thin) echo "-flto=thin" ;;
+    g) echo "-g" ;;
+    instr) echo "-finstrument" ;;
+  esac
+}
+
+build () {  # build <programma> <modalità>: IR non ottimizzato in $DIR/<programma>.ll
+  case $2 in
+    lto) ./kcomp $(options "$2") -o "$DIR/$1.ll" "bench/runbench/$1.k" ;;
+    # Il bitcode va accanto al sorgente: quello copiato in $DIR
+    thin) cp "bench/runbench/$1.k" "$DIR/$1.k"
+          ./kcomp $(options "$2") "$DIR/$1.k"
+          "$BIN/llvm-dis" "$DIR/$1.bc" -o "$DIR/$1.ll" ;;
+    *) ./kcomp $(options "$2") "bench/runbench/$1.k" 2> "$DIR/$1.ll" ;;
+  esac
+}
+
+levels () {  # levels <modalità>: livelli di ottimizzazione da misurare
+  case $1 in
+    lto|thin) echo "$1" ;;
+    g|instr) echo 2 ;;
+    *) echo $LEVELS ;;
+  esac
+}
+
+link () {  # link <programma> <modalità> <livello>: eseguibile $DIR/<programma>
+  case $3 in
+    lto) IN="$DIR/$1.ll" OPT=2 ;;
+    thin) IN="$DIR/$1.bc" OPT=2
+          "$BIN/opt" -passes='thinlto<O2>' "$DIR/$1.ll" -o "$IN" ;;
+    *) IN="$DIR/$1.bc" OPT=$3
+       "$BIN/opt" -O$3 "$DIR/$1.ll" -o "$IN" ;;
+  esac
+  "$BIN/llc" -O$OPT -relocation-model=pic -filetype=obj "$IN" -o "$DIR/$1.o"
+  if [ "$2" = instr ]; then
+    cc -O2 bench/runbench_main.c "$DIR/$1.o" libkprof.a -lstdc++ -lm -o "$DIR/$1"
+  else
+    cc -O2 bench/runbench_main.c "$DIR/$1.o" -lm -o "$DIR/$1"
+  fi
+}
+
+
+median () {  # median <file>: mediana dei tempi (primo campo di ogni riga)
+  sort -n "$1" | awk '{ t[NR] = $1 } END { print t[int((NR + 1) / 2)] }'
+}
+
+minimum () {  # minimum <file>: il minore dei tempi
+  sort -n "$1" | awk 'NR == 1 { print $1 }'
+}
+
+measure () {  # measure <comando>: "tempo risultato" di ogni ripetizione
+  for i in $(seq "$REPS"); do
+    taskset -c 0 "$@"
+  done > "$DIR/times"
+}
+
+paired () {  # paired <comando>: come measure, alternato con il C (in $DIR/ctimes)
+  for i in $(seq "$REPS"); do
+    taskset -c 0 "$DIR/$P-c" >> "$DIR/ctimes"
+    taskset -c 0 "$@"
+  done > "$DIR/times"
+}
+
+elapsed () {  # elapsed <comando>: come measure, con il tempo misurato da fuori
+  # kcomp -run scrive il risultato, da solo su una riga, sullo stream di
+  # uscita del driver (stderr), che può contenere anche diagnostica
+  for i in $(seq "$REPS"); do
+    START=$(date +%s.%N)
+    RES=$(taskset -c 0,1 "$@" 2>&1 >/dev/null | grep -E '^-?([0-9.]+(e[-+][0-9]+)?|inf|nan)$' | tail -n 1)
+    END=$(date +%s.%N)
+    T=$(echo "$START $END" | awk '{ printf "%.6f", $2 - $1 }')
+    echo "$T ${RES:-?}"
+  done > "$DIR/times"
+}
+
+report () {  # report <programma> <modalità> <livello>
+  T=$(median "$DIR/times")
+  RES=$(awk '{ print $2 }' "$DIR/times" | sort -u)
+  NOTE=""
+  if [ "$RES" != "$REF" ]; then
+    NOTE="  risultato errato: $RES (C: $REF)"
+    STATUS=1
+  fi
+  if [ "$2" != C ] && [ "$2" != tiered ]; then
+    R=$(awk -v t="$(minimum "$DIR/times")" -v c="$(minimum "$DIR/ctimes")" \
+      'BEGIN { printf "%.2f", t / c }')
+    echo "$1 $2 $3 $R" >> "$DIR/base"
+    B=$(awk -v p="$1" -v m="$2" -v l="$3" '$1 == p && $2 == m && $3 == l { print $4 }' \
+        "$BASE" 2>/dev/null || true)
+    if [ "$UPDATE" = 0 ] && [ -n "$B" ] &&
+       awk -v r="$R" -v b="$B" -v k="$TOLERANCE" 'BEGIN { exit !(r > b * k) }'; then
+      NOTE="$NOTE  regressione: riferimento ${B}x"
+      STATUS=1
+    fi
+  fi
+  awk -v p="$1" -v m="$2" -v l="$3" -v t="$T" -v c="$CTIME" -v n="$NOTE" \
+    'BEGIN { printf "%-8s %-9s %-3s %10.4fs %8.2fx%s\n", p, m, l, t, t / c, n }'
+}
+
+printf "%-8s %-9s %-3s %11s %9s\n" programma modalità -O mediana "/C"
+for P in $PROGS; do
+  cc -O2 bench/runbench_main.c "bench/runbench/$P.c" -lm -o "$DIR/$P-c"
+  measure "$DIR/$P-c"
+  CTIME=$(median "$DIR/times")
+  REF=$(awk '{ print $2 }' "$DIR/times" | sort -u)
+  report "$P" C 2
+  for M in $MODES; do
+    build "$P" "$M"
+    for L in $(levels "$M"); do
+      link "$P" "$M" "$L"
+      rm -f "$DIR/ctimes"
+      paired "$DIR/$P"
+      report "$P" "$M" "$L"
+    done
+  done
+  elapsed ./kcomp -run bench "bench/runbench/$P.k"
+  report "$P" tiered -
+done
+if [ "$UPDATE" = 1 ]; then
+  { echo "# Rapporti con il C (bench/runbench.sh -u, LLVM $("$BIN/llvm-config" --version), $REPS ripetizioni)"
+    cat "$DIR/base"; } > "$BASE"
+fi
+exit $STATUS
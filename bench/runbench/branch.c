@@ -0,0 +1,25 @@
+double score(double x, double y) {
+  if (x < 0.25 && y < 0.5) return y + 1;
+  else if (x < 0.5 || y < 0.25) return y * 2;
+  else if (!(x < 0.75)) return y - 3;
+  else return y / 2;
+}
+
+double orbit(double x0, double n) {
+  double x = x0;
+  double y = 1 - x0;
+  double s = 0;
+  for (double k = 0; k < n; ++k) {
+    x = 3.99 * x * (1 - x);
+    y = 3.97 * y * (1 - y);
+    s = s + score(x, y) + (x < y ? 1 : y == x ? 0 : -1);
+  }
+  return s;
+}
+
+double bench(void) {
+  double t = 0;
+  for (double r = 0; r < 200; ++r)
+    t = t + orbit(0.1 + r / 250, 100000);
+  return t;
+}
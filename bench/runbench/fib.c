@@ -0,0 +1,7 @@
+double fib(double n) {
+  return n < 2 ? n : fib(n-1) + fib(n-2);
+}
+
+double bench(void) {
+  return fib(35);
+}
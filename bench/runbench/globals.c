@@ -0,0 +1,23 @@
+double sum, sumsq, count, maxv;
+
+double observe(double v) {
+  sum = sum + v;
+  sumsq = sumsq + v * v;
+  count = count + 1;
+  maxv = maxv < v ? v : maxv;
+  return v;
+}
+
+double feed(double n) {
+  double t = 0;
+  for (double q = 0; q < n; ++q)
+    t = t + observe((q * 7919) / (q + 13));
+  return t;
+}
+
+double bench(void) {
+  double total = 0;
+  for (double r = 0; r < 200; ++r)
+    total = total + feed(100000);
+  return total + sum + sumsq / count + maxv;
+}
@@ -0,0 +1,14 @@
+double grid(double n) {
+  double s = 0;
+  for (double i = 0; i < n; ++i)
+    for (double j = 0; j < n; ++j)
+      s = s + (i * j) / (i + j + 1);
+  return s;
+}
+
+double bench(void) {
+  double t = 0;
+  for (double r = 0; r < 200; ++r)
+    t = t + grid(600);
+  return t;
+}
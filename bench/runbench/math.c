@@ -0,0 +1,15 @@
+#include <math.h>
+
+double wave(double n) {
+  double acc = 0;
+  for (double m = 1; m < n; ++m)
+    acc = acc + sin(m * 0.001) * cos(m * 0.002) + sqrt(m) / log(m + 1) + 1 / exp(m * 0.0001);
+  return acc;
+}
+
+double bench(void) {
+  double t = 0;
+  for (double r = 0; r < 40; ++r)
+    t = t + wave(50000);
+  return t;
+}
@@ -0,0 +1,20 @@
+/* Driver C per i programmi di bench/runbench: misura il tempo di bench()
+   (Kaleidoscope o riferimento C) e ne stampa anche il risultato, che deve
+   essere lo stesso in tutte le modalità */
+#include <stdio.h>
+#include <time.h>
+
+double bench(void);
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void) {
+  double start = now();
+  double r = bench();
+  printf("%.6f %.17g\n", now() - start, r);
+  return 0;
+}
@@ -0,0 +1,51 @@
+// Microbenchmark dello scanner: misura i token al secondo prodotti da yylex.
+// Uso: scanbench [file.k [ripetizioni]]
+// Senza file viene generato un sorgente sintetico di qualche decina di MB
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include "../driver.hpp"
+
+// Sorgente sintetico con un mix realistico di identificatori, numeri,
+// parole chiave, operatori e spazi
+static std::string synth (const std::string& path, int nfun)
+{
+  std::ofstream os(path);
+  for (int i=0; i<nfun; i++) {
+    os << "def fun" << i << "(alpha beta gamma) {\n"
+       << "  var acc = 0.0;\n"
+       << "  for (var i = 0; i < alpha; ++i)\n"
+       << "    acc = acc + beta * 3.14159 - gamma / 2.5e-3;\n"
+       << "  acc < 1000 and not (acc == 0) ? acc : fun" << i << "(acc 1 2)\n"
+       << "};\n";
+  }
+  return path;
+}
+
+int
+main (int argc, char *argv[])
+{
+  std::string file = argc > 1 ? argv[1] : synth("/tmp/scanbench.k", 200000);
+  int reps = argc > 2 ? atoi(argv[2]) : 5;
+
+  double best = 0;
+  long tokens = 0;
+  for (int r=0; r<reps; r++) {
+    driver drv;
+    drv.file = file;
+    drv.location.initialize(&drv.file);
+    if (!drv.scan_begin())
+      return 1;
+    tokens = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (yylex(drv).kind() != yy::parser::symbol_kind::S_YYEOF)
+      tokens++;
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+    drv.scan_end();
+    best = std::max(best, tokens / secs.count());
+  }
+  std::cout << file << ": " << tokens << " token, "
+            << best / 1e6 << " Mtoken/s (migliore su " << reps << ")\n";
+  return 0;
+}
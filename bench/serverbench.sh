@@ -0,0 +1,32 @@
+#!/bin/sh
+# Costo di avvio: N piccoli file compilati uno alla volta con kcomp e con
+# kcompc attraverso un compile server avviato per l'occasione.
+# Uso (dalla directory principale, dopo make): bench/serverbench.sh [N]
+set -e
+N=${1:-500}
+DIR=$(mktemp -d)
+SOCK="$DIR/kcomp.sock"
+trap 'kill $SERVER 2>/dev/null; rm -rf "$DIR"' EXIT
+
+for i in $(seq "$N"); do
+  printf 'def f%s(x y) {\n  var a = x * y;\n  a < 10 ? a + %s : a - y\n};\n' "$i" "$i" > "$DIR/f$i.k"
+done
+
+./kcomp -server "$SOCK" &
+SERVER=$!
+while [ ! -S "$SOCK" ]; do sleep 0.05; done
+
+elapsed () {  # elapsed <comando>: secondi per compilare tutti i file
+  START=$(date +%s.%N)
+  for i in $(seq "$N"); do
+    $1 "$DIR/f$i.k" 2> /dev/null
+  done
+  END=$(date +%s.%N)
+  echo "$START $END" | awk '{ printf "%.3f", $2 - $1 }'
+}
+
+DIRECT=$(elapsed ./kcomp)
+CLIENT=$(KCOMP_SERVER="$SOCK" elapsed ./kcompc)
+echo "kcomp:             ${DIRECT}s per $N file"
+echo "kcompc + server:   ${CLIENT}s per $N file"
+awk -v a="$DIRECT" -v b="$CLIENT" 'BEGIN { printf "accelerazione:     %.1fx\n", a / b }'
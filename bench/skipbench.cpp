@@ -0,0 +1,226 @@
+// Stima del guadagno possibile dalle due ottimizzazioni dello scanner non
+// adottate: salto di spazi e identificatori con istruzioni SIMD (SSE2) e
+// location calcolate solo su richiesta. Non usa lo scanner generato da
+// flex: sullo stesso sorgente sintetico di scanbench (o su un file) misura
+//  - la lunghezza media delle sequenze di spazi e degli identificatori;
+//  - il tempo per saltarle un carattere alla volta con una tabella (ciò che
+//    fa il DFA di flex con -Cf) e 16 caratteri alla volta con SSE2;
+//  - il costo per token dell'aggiornamento della location (YY_USER_ACTION
+//    e loc.step) e quello della costruzione del simbolo per bison, che ogni
+//    token paga comunque.
+// Uso: skipbench [file.k [ripetizioni]]
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <emmintrin.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+#include "../parser.hpp"
+
+// Lo stesso sorgente sintetico di scanbench
+static std::string synth (const std::string& path, int nfun)
+{
+  std::ofstream os(path);
+  for (int i=0; i<nfun; i++) {
+    os << "def fun" << i << "(alpha beta gamma) {\n"
+       << "  var acc = 0.0;\n"
+       << "  for (var i = 0; i < alpha; ++i)\n"
+       << "    acc = acc + beta * 3.14159 - gamma / 2.5e-3;\n"
+       << "  acc < 1000 and not (acc == 0) ? acc : fun" << i << "(acc 1 2)\n"
+       << "};\n";
+  }
+  return path;
+}
+
+// Classi dei caratteri, come le vede il DFA: una lettura di tabella per
+// carattere
+enum { OTHER, BLANK, NEWLINE, ALPHA, DIGIT };
+static unsigned char cls[256];
+
+static bool isIdChar (unsigned char c)
+{
+  return cls[c] == ALPHA || cls[c] == DIGIT || c == '_';
+}
+
+static size_t skipBlanks (const char *s, size_t i)
+{
+  while (cls[(unsigned char) s[i]] == BLANK)
+    i++;
+  return i;
+}
+
+static size_t skipId (const char *s, size_t i)
+{
+  while (isIdChar(s[i]))
+    i++;
+  return i;
+}
+
+// Come sopra, 16 caratteri alla volta: la prima posizione che non
+// appartiene alla sequenza è il primo zero della maschera
+static size_t skipBlanksSSE (const char *s, size_t i)
+{
+  for (;;) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (s + i));
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                             _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+    unsigned mask = ~_mm_movemask_epi8(m) & 0xffff;
+    if (mask)
+      return i + __builtin_ctz(mask);
+    i += 16;
+  }
+}
+
+static size_t skipIdSSE (const char *s, size_t i)
+{
+  for (;;) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (s + i));
+    // Minuscole e maiuscole insieme (bit 0x20), poi confronti con segno
+    __m128i l = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8('a' - 1)),
+                                  _mm_cmplt_epi8(l, _mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    __m128i m = _mm_or_si128(_mm_or_si128(alpha, digit), _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+    unsigned mask = ~_mm_movemask_epi8(m) & 0xffff;
+    if (mask)
+      return i + __builtin_ctz(mask);
+    i += 16;
+  }
+}
+
+// Token del sorgente: posizione, lunghezza e classe del primo carattere
+struct token {
+  uint32_t pos, len;
+  unsigned char kind;
+};
+
+static std::vector<token> tokenize (const std::string& src)
+{
+  std::vector<token> toks;
+  const char *s = src.c_str();
+  for (size_t i=0; i<src.size(); ) {
+    size_t j = i + 1;
+    unsigned char k = cls[(unsigned char) s[i]];
+    if (k == BLANK)
+      j = skipBlanks(s, i);
+    else if (k == NEWLINE)
+      while (s[j] == '\n') j++;
+    else if (k == ALPHA)
+      j = skipId(s, i);
+    else if (k == DIGIT || s[i] == '.')
+      while (cls[(unsigned char) s[j]] == DIGIT || strchr(".eE", s[j]) ||
+             ((s[j] == '-' || s[j] == '+') && (s[j-1] == 'e' || s[j-1] == 'E'))) j++;
+    toks.push_back({(uint32_t) i, (uint32_t) (j - i), k});
+    i = j;
+  }
+  return toks;
+}
+
+template <typename F>
+static double best (int reps, F f)
+{
+  double b = 1e30;
+  for (int r=0; r<reps; r++) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+    b = std::min(b, secs.count());
+  }
+  return b * 1e3;
+}
+
+int
+main (int argc, char *argv[])
+{
+  std::string file = argc > 1 ? argv[1] : synth("/tmp/scanbench.k", 200000);
+  int reps = argc > 2 ? atoi(argv[2]) : 5;
+  std::ifstream in(file, std::ios::binary);
+  std::string src((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  src.append(16, '\0');  // Le letture SSE2 possono superare la fine
+  for (int c='a'; c<='z'; c++) cls[c] = cls[c - 'a' + 'A'] = ALPHA;
+  for (int c='0'; c<='9'; c++) cls[c] = DIGIT;
+  cls[' '] = cls['\t'] = BLANK;
+  cls['\n'] = NEWLINE;
+
+  std::vector<token> toks = tokenize(src);
+  uint64_t nblank = 0, lblank = 0, nid = 0, lid = 0, ntok = 0;
+  for (auto& t : toks) {
+    if (t.kind == BLANK) { nblank++; lblank += t.len; }
+    else if (t.kind != NEWLINE) ntok++;
+    if (t.kind == ALPHA) { nid++; lid += t.len; }
+  }
+
+  // Salto di tutte le sequenze di spazi e degli identificatori, a partire
+  // dall'inizio di ciascuna (gli altri token non costano nulla)
+  const char *s = src.c_str();
+  volatile size_t sink = 0;
+  auto skipAll = [&](auto blanks, auto ids) {
+    size_t sum = 0;
+    for (auto& t : toks)
+      if (t.kind == BLANK)
+        sum += blanks(s, t.pos);
+      else if (t.kind == ALPHA)
+        sum += ids(s, t.pos);
+    sink = sum;
+  };
+  double tscalar = best(reps, [&]() { skipAll(skipBlanks, skipId); });
+  double tsse = best(reps, [&]() { skipAll(skipBlanksSSE, skipIdSSE); });
+
+  // Location: quello che lo scanner fa ad ogni match, al netto di un ciclo
+  // con gli stessi salti che tiene solo la posizione nel file
+  double tpos = best(reps, [&]() {
+    size_t pos = 0, lines = 0;
+    for (auto& t : toks) {
+      if (t.kind == NEWLINE)
+        lines += t.len;
+      pos += t.len;
+    }
+    sink = pos + lines;
+  });
+  double tloc = best(reps, [&]() {
+    std::string name = file;
+    yy::location loc(&name);
+    for (auto& t : toks) {
+      if (t.kind != BLANK && t.kind != NEWLINE)
+        loc.step();
+      if (t.kind == NEWLINE)
+        loc.lines(t.len);
+      else
+        loc.columns(t.len);
+    }
+    sink = loc.end.column;
+  });
+
+  // Simboli per bison: identificatori (con la stringa), numeri e operatori
+  double tsym = best(reps, [&]() {
+    std::string name = file;
+    yy::location loc(&name);
+    size_t sum = 0;
+    for (auto& t : toks) {
+      if (t.kind == ALPHA) {
+        yy::parser::symbol_type sym = yy::parser::make_IDENTIFIER(std::string(s + t.pos, t.len), loc);
+        sum += sym.kind();
+      } else if (t.kind == DIGIT) {
+        yy::parser::symbol_type sym = yy::parser::make_NUMBER(1.0, loc);
+        sum += sym.kind();
+      } else if (t.kind == OTHER) {
+        yy::parser::symbol_type sym = yy::parser::make_PLUS(loc);
+        sum += sym.kind();
+      }
+    }
+    sink = sum;
+  });
+
+  std::cout << file << ": " << ntok << " token, " << src.size() / 1024 / 1024 << " MB\n"
+            << "spazi:            " << nblank << " sequenze, lunghezza media " << (double) lblank / nblank << "\n"
+            << "identificatori:   " << nid << ", lunghezza media " << (double) lid / nid << "\n"
+            << "salto scalare:    " << tscalar << " ms\n"
+            << "salto SSE2:       " << tsse << " ms (" << (tscalar - tsse) * 1e6 / ntok << " ns/token risparmiati)\n"
+            << "location:         " << tloc << " ms (" << (tloc - tpos) * 1e6 / ntok << " ns/token oltre la sola posizione)\n"
+            << "simboli bison:    " << tsym << " ms (" << tsym * 1e6 / ntok << " ns/token)\n"
+            << "(migliore su " << reps << " ripetizioni)\n";
+  return 0;
+}
@@ -1,14 +1,18 @@
 #include "driver.hpp"
+#include "eval.hpp"
 #include "parser.hpp"
-
-// Generazione di un'istanza per ciascuna della classi LLVMContext,
-// Module e IRBuilder. Nel caso di singolo modulo è sufficiente
-LLVMContext *context = new LLVMContext;
-Module *module = new Module("Kaleidoscope", *context);
-IRBuilder<> *builder = new IRBuilder(*context);
-
-Value *LogErrorV(const std::string Str) {
-  std::cerr << Str << std::endl;
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+// Non ci sono istanze globali di LLVMContext, Module e IRBuilder: ciascun
+// driver possiede le proprie, così che più driver (uno per file sorgente)
+// possano compilare in parallelo nello stesso processo senza interferire
+Value *LogErrorV(driver& drv, const std::string Str) {
+  *drv.diag << Str << "\n";
+  drv.errors++;
   return nullptr;
 }
 
@@ -24,19 +28,73 @@ Value *LogErrorV(const std::string Str) {
    interferire con il builder globale, la generazione viene dunque effettuata
    con un builder temporaneo TmpB
 */
-static AllocaInst *CreateEntryBlockAlloca(Function *fun, StringRef VarName, Type* T = Type::getDoubleTy(*context)) {
+AllocaInst *CreateEntryBlockAlloca(Function *fun, StringRef VarName, Type* T) {
   IRBuilder<> TmpB(&fun->getEntryBlock(), fun->getEntryBlock().begin());
-  return TmpB.CreateAlloca(Type::getDoubleTy(*context), nullptr, VarName);
+  return TmpB.CreateAlloca(T ? T : Type::getDoubleTy(fun->getContext()), nullptr, VarName);
 }
 
-// Implementazione del costruttore della classe driver
-driver::driver(): trace_parsing(false), trace_scanning(false) {};
+// Implementazione del costruttore della classe driver. Ogni driver crea
+// il proprio modulo e il proprio builder e, se non gliene viene passato uno
+// (come avviene quando più moduli devono essere collegati fra loro), anche
+// il proprio contesto; di default il codice IR e i messaggi di errore
+// vengono scritti su stderr
+driver::driver(LLVMContext *ctx): sources(nullptr), outputs(nullptr), source(nullptr),
+  trace_parsing(false), trace_scanning(false), scanner(nullptr),
+  debug_info(false), emit_module(false), slots(nullptr), dbuilder(nullptr), dunit(nullptr),
+  instrument(false), instrument_min(0), ProfBase(nullptr), ssa(false), fold(0), folder(nullptr) {
+  owncontext = !ctx;
+  context = ctx ? ctx : new LLVMContext;
+  module = new Module("Kaleidoscope", *context);
+  builder = new IRBuilder(*context);
+  out = &errs();
+  diag = &errs();
+  errors = 0;
+};
+
+// Il modulo fa riferimento al contesto, che va quindi distrutto per ultimo
+driver::~driver() {
+  delete slots;
+  delete dbuilder;
+  delete builder;
+  delete module;
+  if (owncontext)
+    delete context;
+};
+
+// Copia le opzioni di compilazione (non lo stato) da un altro driver,
+// tipicamente quello usato per leggere la riga di comando
+void driver::setOptions(const driver& opts) {
+  trace_parsing = opts.trace_parsing;
+  trace_scanning = opts.trace_scanning;
+  debug_info = opts.debug_info;
+  emit_module = opts.emit_module;
+  instrument = opts.instrument;
+  instrument_min = opts.instrument_min;
+  ssa = opts.ssa;
+  fold = opts.fold;
+  sources = opts.sources;
+  outputs = opts.outputs;
+  cwd = opts.cwd;
+};
 
 // Implementazione del metodo parse
 int driver::parse (const std::string &f) {
   file = f;                    // File con il programma
+  source = nullptr;            // Con sources, il testo già in memoria
+  // Un file che il client non ha potuto leggere (e quindi non ha inviato)
+  // viene aperto dallo scanner, che ne segnala l'errore come per kcomp
+  if (sources) {
+    auto it = sources->find(f);
+    if (it != sources->end())
+      source = &it->second;
+    else if (f == "-") {
+      *diag << "cannot open -: standard input non inviato al server\n";
+      return 1;
+    }
+  }
   location.initialize(&file);  // Inizializzazione dell'oggetto location
-  scan_begin();                // Inizio scanning (ovvero apertura del file programma)
+  if (!scan_begin())           // Inizio scanning (ovvero apertura del file programma)
+    return 1;
   yy::parser parser(*this);    // Istanziazione del parser
   parser.set_debug_level(trace_parsing); // Livello di debug del parsed
   int res = parser.parse();    // Chiamata dell'entry point del parser
@@ -45,9 +103,341 @@ int driver::parse (const std::string &f) {
 }
 
 // Implementazione del metodo codegen, che è una "semplice" chiamata del 
-// metodo omonimo presente nel nodo root (il puntatore root è stato scritto dal parser)
-void driver::codegen() {
-  root->codegen(*this);
+// metodo omonimo presente nel nodo root (il puntatore root è stato scritto dal parser).
+// Con -g viene prima creata la compile unit DWARF del file corrente e, alla fine,
+// i metadati vengono finalizzati prima di emettere il modulo.
+// Con -ffold ogni definizione viene prima semplificata valutandone le parti
+// costanti (si veda SeqAST::codegen).
+// Come parse, restituisce 0 oppure 1 se sono stati segnalati errori
+int driver::codegen() {
+  unsigned before = errors;
+  if (debug_info) {
+    delete dbuilder;
+    dbuilder = new DIBuilder(*module);
+    if (!module->getModuleFlag("Debug Info Version")) {
+      module->addModuleFlag(Module::Warning, "Debug Info Version", DEBUG_METADATA_VERSION);
+      module->addModuleFlag(Module::Warning, "Dwarf Version", 4);
+    }
+    // gdb e llvm-symbolizer cercano il sorgente a partire dalla directory
+    // registrata nella compile unit, che quindi deve essere assoluta. Con
+    // il compile server è relativa alla directory del client, non del server
+    SmallString<128> path(file);
+    if (cwd.empty())
+      sys::fs::make_absolute(path);
+    else
+      sys::fs::make_absolute(cwd, path);
+    dunit = dbuilder->createCompileUnit(dwarf::DW_LANG_C,
+        dbuilder->createFile(sys::path::filename(path), sys::path::parent_path(path)),
+        "kcomp", false, "", 0);
+  }
+  if (fold) {
+    Evaluator ev(fold);
+    ev.compiled = module;
+    folder = &ev;
+    root->codegen(*this);
+    folder = nullptr;
+  } else
+    root->codegen(*this);
+  if (instrument)
+    emitProfRegistration();
+  if (dbuilder)
+    dbuilder->finalize();
+  if (emit_module)
+    module->print(*out, nullptr);
+  return errors != before;
+};
+
+// Con il compile server i percorsi relativi sono quelli del client
+std::string driver::path() const {
+  if (cwd.empty())
+    return file;
+  SmallString<128> p(file);
+  sys::fs::make_absolute(cwd, p);
+  return std::string(p);
+};
+
+// Emissione di una definizione appena generata, se il modulo non viene
+// emesso per intero. I metadati allegati alle istruzioni (i pesi dei salti
+// di likely/unlikely) non fanno parte della stampa di una funzione: le loro
+// definizioni sono emesse subito dopo, una volta sola. Tutte le definizioni
+// sono stampate con lo stesso ModuleSlotTracker, così che ogni metadato
+// mantenga lo stesso numero (!0, !1, ...) in tutto il codice emesso
+void driver::emit(GlobalObject *GO) {
+  if (emit_module)
+    return;
+  if (!slots)
+    slots = new ModuleSlotTracker(module, false);
+  Function *F = dyn_cast<Function>(GO);
+  // Gli intrinseci (riduzioni dei vettori) vanno dichiarati prima dell'uso;
+  // senza attributi, che il parser dell'IR ricava dal nome
+  if (F)
+    for (auto& BB : *F)
+      for (auto& I : BB)
+        if (auto *CI = dyn_cast<CallInst>(&I)) {
+          Function *Callee = CI->getCalledFunction();
+          if (!Callee || !Callee->isIntrinsic() || !emittedIntrinsics.insert(Callee).second)
+            continue;
+          FunctionType *FT = Callee->getFunctionType();
+          *out << "declare " << *FT->getReturnType() << " @" << Callee->getName() << "(";
+          for (unsigned i = 0; i < FT->getNumParams(); i++)
+            *out << (i ? ", " : "") << *FT->getParamType(i);
+          *out << ")\n\n";
+        }
+  GO->print(*out, *slots);
+  *out << "\n";
+  if (!F)
+    return;
+  SmallVector<std::pair<unsigned, MDNode*>, 2> MDs;
+  for (auto& BB : *F)
+    for (auto& I : BB) {
+      I.getAllMetadata(MDs);
+      for (auto& MD : MDs)
+        if (emittedMD.insert(MD.second).second) {
+          MD.second->print(*out, *slots, module);
+          *out << "\n";
+        }
+    }
+};
+
+// Scrive un file prodotto dalla compilazione (o lo raccoglie in outputs)
+bool driver::writeFile (const std::string& name, StringRef data) const {
+  if (outputs) {
+    (*outputs)[name] = data.str();
+    return true;
+  }
+  std::error_code EC;
+  raw_fd_ostream os(name, EC, sys::fs::OF_None);
+  if (EC) {
+    *diag << "cannot open " << name << ": " << EC.message() << "\n";
+    return false;
+  }
+  os << data;
+  return true;
+};
+
+// Tipo DWARF corrispondente all'unico tipo del linguaggio
+DIType *driver::getDoubleDIType() {
+  return dbuilder->createBasicType("double", 64, dwarf::DW_ATE_float);
+};
+
+// I vettori sono descritti come array "vettoriali" di double
+DIType *driver::getDIType(Type *T) {
+  auto *VT = dyn_cast<FixedVectorType>(T);
+  if (!VT)
+    return getDoubleDIType();
+  unsigned N = VT->getNumElements();
+  return dbuilder->createVectorType(64 * N, 64 * N, getDoubleDIType(),
+      dbuilder->getOrCreateArray({dbuilder->getOrCreateSubrange(0, N)}));
+};
+
+// Le istruzioni generate da qui in avanti vengono associate alla posizione
+// nel sorgente del nodo AST (nello scope più interno). Con AST nullo la
+// posizione viene azzerata (ad esempio nel prologo delle funzioni)
+void driver::emitLocation(RootAST *AST) {
+  if (!dbuilder || LexicalBlocks.empty())
+    return;
+  if (!AST)
+    return builder->SetCurrentDebugLocation(DebugLoc());
+  DIScope *Scope = LexicalBlocks.back();
+  builder->SetCurrentDebugLocation(
+      DILocation::get(Scope->getContext(), AST->getLine(), AST->getCol(), Scope));
+};
+
+// Registra un nuovo sito di profiling e genera il codice che ne calcola
+// l'indice globale: il runtime (kprof.cpp) assegna ad ogni modulo una base,
+// letta da @__kprof.base, cui si somma l'indice locale del sito
+Value *driver::profSite(char kind, const std::string& name) {
+  if (!ProfBase)
+    ProfBase = new GlobalVariable(*module, builder->getInt32Ty(), false,
+        GlobalValue::InternalLinkage, builder->getInt32(0), "__kprof.base");
+  Value *base = builder->CreateLoad(builder->getInt32Ty(), ProfBase, "prof.base");
+  ProfKinds.push_back(kind);
+  ProfSites.push_back(name);
+  return builder->CreateAdd(base, builder->getInt32(ProfSites.size()-1), "prof.site");
+};
+
+// Misura dei cicli di clock (rdtsc su x86) di una funzione appena generata,
+// con il builder posizionato prima del return. Il tempo proprio (esclusi
+// i callee strumentati) si ottiene con un accumulatore per thread definito
+// nel runtime, @__kprof_child: all'ingresso se ne salva il valore e lo si
+// azzera, così che all'uscita contenga i cicli dei callee; gli si somma poi
+// il tempo inclusivo della funzione, che il chiamante sottrarrà al proprio.
+// Le funzioni con meno di instrument_min istruzioni non sono misurate (il
+// loro tempo resta in quello proprio del chiamante)
+void driver::profFunction(Function *function) {
+  size_t size = 0;
+  for (auto& BB : *function)
+    size += BB.size();
+  if (size < instrument_min)
+    return;
+  GlobalVariable *Child = module->getNamedGlobal("__kprof_child");
+  if (!Child)
+    Child = new GlobalVariable(*module, builder->getInt64Ty(), false,
+        GlobalValue::ExternalLinkage, nullptr, "__kprof_child", nullptr,
+        GlobalValue::GeneralDynamicTLSModel);
+  Value *Site, *Start, *Saved;
+  {
+    IRBuilderBase::InsertPointGuard Guard(*builder);
+    BasicBlock &Entry = function->getEntryBlock();
+    builder->SetInsertPoint(&Entry, Entry.getFirstInsertionPt());
+    Site = profSite('F', function->getName().str());
+    Start = builder->CreateIntrinsic(Intrinsic::readcyclecounter, {}, {}, nullptr, "prof.start");
+    Saved = builder->CreateLoad(builder->getInt64Ty(), Child, "prof.saved");
+    builder->CreateStore(builder->getInt64(0), Child);
+  }
+  Value *End = builder->CreateIntrinsic(Intrinsic::readcyclecounter, {}, {}, nullptr, "prof.end");
+  Value *Cycles = builder->CreateSub(End, Start, "prof.cycles");
+  Value *Self = builder->CreateSub(Cycles,
+      builder->CreateLoad(builder->getInt64Ty(), Child, "prof.child"), "prof.self");
+  builder->CreateStore(builder->CreateAdd(Saved, Cycles), Child);
+  FunctionCallee ProfFunc = module->getOrInsertFunction("__kprof_func",
+      builder->getVoidTy(), builder->getInt32Ty(), builder->getInt64Ty(), builder->getInt64Ty());
+  builder->CreateCall(ProfFunc, {Site, Cycles, Self});
+};
+
+// Genera le tabelle con nome e tipo dei siti e un costruttore del modulo
+// che le registra presso il runtime (__kprof_register), memorizzando la base
+// restituita. I siti registrati vengono poi "dimenticati", così che un
+// successivo codegen sullo stesso modulo crei una nuova registrazione
+void driver::emitProfRegistration() {
+  if (ProfSites.empty())
+    return;
+  Type *PtrTy = builder->getInt8PtrTy();
+  std::vector<Constant*> Names;
+  for (auto& name : ProfSites)
+    Names.push_back(builder->CreateGlobalStringPtr(name, "prof.name", 0, module));
+  ArrayType *NamesTy = ArrayType::get(PtrTy, Names.size());
+  GlobalVariable *NamesGV = new GlobalVariable(*module, NamesTy, true,
+      GlobalValue::PrivateLinkage, ConstantArray::get(NamesTy, Names), "__kprof.names");
+  Constant *KindsInit = ConstantDataArray::getString(*context, ProfKinds, false);
+  GlobalVariable *KindsGV = new GlobalVariable(*module, KindsInit->getType(), true,
+      GlobalValue::PrivateLinkage, KindsInit, "__kprof.kinds");
+
+  FunctionCallee Register = module->getOrInsertFunction("__kprof_register",
+      builder->getInt32Ty(), PtrTy, PtrTy, builder->getInt32Ty());
+  Function *Init = Function::Create(FunctionType::get(builder->getVoidTy(), false),
+      GlobalValue::InternalLinkage, "__kprof.init", *module);
+  IRBuilder<> B(BasicBlock::Create(*context, "entry", Init));
+  Value *Base = B.CreateCall(Register, {ConstantExpr::getPointerCast(NamesGV, PtrTy),
+      ConstantExpr::getPointerCast(KindsGV, PtrTy), B.getInt32(Names.size())});
+  B.CreateStore(Base, ProfBase);
+  B.CreateRetVoid();
+  appendToGlobalCtors(*module, Init, 0);
+
+  ProfSites.clear();
+  ProfKinds.clear();
+  ProfBase = nullptr;
+};
+
+/************************* Costruzione SSA *************************/
+// Lo stato è relativo alla funzione in corso di generazione
+void driver::resetSSA() {
+  SSAVars.clear();
+  SSANames.clear();
+  SSATypes.clear();
+  CurrentDef.clear();
+  IncompletePhis.clear();
+  SealedBlocks.clear();
+};
+
+int driver::declareVariable(const std::string& name, Type *T) {
+  SSANames.push_back(name);
+  SSATypes.push_back(T);
+  return SSANames.size() - 1;
+};
+
+void driver::writeVariable(int var, BasicBlock *BB, Value *V) {
+  CurrentDef[BB][var] = V;
+};
+
+// Se la variabile è definita nel blocco si usa quella definizione,
+// altrimenti la si cerca (ricorsivamente) nei predecessori
+Value *driver::readVariable(int var, BasicBlock *BB) {
+  auto defs = CurrentDef.find(BB);
+  if (defs != CurrentDef.end()) {
+    auto def = defs->second.find(var);
+    if (def != defs->second.end() && def->second)
+      return def->second;
+  }
+  return readVariableRecursive(var, BB);
+};
+
+// Le PHI vanno sempre all'inizio del blocco
+static PHINode *CreatePhiAtStart(BasicBlock *BB, Type *T, const std::string& name) {
+  if (Instruction *I = BB->getFirstNonPHI())
+    return PHINode::Create(T, 0, name, I);
+  return PHINode::Create(T, 0, name, BB);
+}
+
+Value *driver::readVariableRecursive(int var, BasicBlock *BB) {
+  Value *V;
+  if (!SealedBlocks.count(BB)) {
+    // Non tutti i predecessori sono noti (ad esempio l'intestazione di un
+    // ciclo prima del salto all'indietro): PHI "incompleta", i cui operandi
+    // verranno aggiunti alla chiusura del blocco
+    PHINode *Phi = CreatePhiAtStart(BB, SSATypes[var], SSANames[var]);
+    IncompletePhis[BB][var] = Phi;
+    V = Phi;
+  } else if (BasicBlock *Pred = BB->getSinglePredecessor()) {
+    // Un solo predecessore: nessuna PHI necessaria
+    V = readVariable(var, Pred);
+  } else if (pred_empty(BB)) {
+    // Blocco di ingresso senza definizione: variabile mai inizializzata
+    V = UndefValue::get(SSATypes[var]);
+  } else {
+    // Più predecessori: la PHI viene registrata prima di leggere gli
+    // operandi, così da interrompere eventuali cicli nella ricerca
+    PHINode *Phi = CreatePhiAtStart(BB, SSATypes[var], SSANames[var]);
+    writeVariable(var, BB, Phi);
+    V = addPhiOperands(var, Phi);
+  }
+  writeVariable(var, BB, V);
+  return V;
+};
+
+Value *driver::addPhiOperands(int var, PHINode *Phi) {
+  BasicBlock *BB = Phi->getParent();
+  for (BasicBlock *Pred : predecessors(BB))
+    Phi->addIncoming(readVariable(var, Pred), Pred);
+  return tryRemoveTrivialPhi(Phi);
+};
+
+// Una PHI i cui operandi sono tutti uguali (o la PHI stessa) è superflua:
+// viene sostituita dall'unico valore e, a cascata, si riesaminano le PHI
+// che la usavano. Le definizioni correnti sono WeakTrackingVH, per cui
+// seguono automaticamente la sostituzione
+Value *driver::tryRemoveTrivialPhi(PHINode *Phi) {
+  Value *Same = nullptr;
+  for (Value *Op : Phi->incoming_values()) {
+    if (Op == Same || Op == Phi)
+      continue;
+    if (Same)
+      return Phi;
+    Same = Op;
+  }
+  if (!Same)
+    Same = UndefValue::get(Phi->getType());
+  SmallVector<WeakVH, 8> Users;
+  for (User *U : Phi->users())
+    if (U != Phi && isa<PHINode>(U))
+      Users.push_back(U);
+  Phi->replaceAllUsesWith(Same);
+  Phi->eraseFromParent();
+  for (WeakVH &U : Users)
+    if (U)
+      tryRemoveTrivialPhi(cast<PHINode>(U));
+  return Same;
+};
+
+// Chiamata quando tutti i predecessori del blocco sono stati generati:
+// le PHI incomplete ricevono i loro operandi. Senza -fssa non fa nulla
+void driver::sealBlock(BasicBlock *BB) {
+  if (!ssa)
+    return;
+  for (auto& [var, Phi] : IncompletePhis[BB])
+    addPhiOperands(var, Phi);
+  IncompletePhis.erase(BB);
+  SealedBlocks.insert(BB);
 };
 
 /************************* Sequence tree **************************/
@@ -57,8 +447,14 @@ SeqAST::SeqAST(RootAST* first, RootAST* continuation):
 
 // mediante chiamate ricorsive viene generato il codice di first e 
 // poi quello di continuation (con gli opportuni controlli di "esistenza")
+// Con -ffold ogni definizione è semplificata subito prima di essere
+// compilata, così che il valutatore possa chiamare solo le funzioni che
+// codegen ha già accettato (si veda Evaluator::compiled)
 Value *SeqAST::codegen(driver& drv) {
-  if (first != nullptr) {
+  if (first != nullptr && drv.folder) {
+    first = first->fold(*drv.folder);
+    first->codegen(drv);
+  } else if (first != nullptr) {
     Value *f = first->codegen(drv);
   } else {
     if (continuation == nullptr) return nullptr;
@@ -67,6 +463,109 @@ Value *SeqAST::codegen(driver& drv) {
   return nullptr;
 };
 
+// Pesi da associare al salto condizionato su una condizione annotata con
+// likely/unlikely (gli stessi usati da __builtin_expect), nullptr se hint è 0.
+// I pesi si riferiscono, nell'ordine, al successore "vero" e a quello "falso"
+MDNode *BranchWeights(driver& drv, int hint) {
+  if (!hint)
+    return nullptr;
+  MDBuilder MDB(*drv.context);
+  return hint > 0 ? MDB.createBranchWeights(2000, 1) : MDB.createBranchWeights(1, 2000);
+}
+
+/************************* Tipi vettoriali *************************/
+Type *LookupType(driver& drv, const std::string& name) {
+  Type *D = Type::getDoubleTy(*drv.context);
+  if (name.empty() || name == "double")
+    return D;
+  if (name == "vec2")
+    return FixedVectorType::get(D, 2);
+  if (name == "vec4")
+    return FixedVectorType::get(D, 4);
+  if (name == "vec8")
+    return FixedVectorType::get(D, 8);
+  return nullptr;
+}
+
+bool IsVectorBuiltin(const std::string& name) {
+  return name == "vec2" || name == "vec4" || name == "vec8" ||
+         name == "hsum" || name == "hmul" || name == "hmin" || name == "hmax";
+}
+
+// vecN(x) replica x su tutte le componenti, vecN(x1, ..., xN) le elenca.
+// Le riduzioni sono tradotte negli intrinseci llvm.vector.reduce.*; somma e
+// prodotto sono "ordinati" (stesso risultato della somma scritta componente
+// per componente), perché il linguaggio non ha opzioni di fast-math
+static Value *VectorBuiltin(driver& drv, const std::string& Name, std::vector<Value*>& Args) {
+  Type *D = Type::getDoubleTy(*drv.context);
+  if (Name[0] == 'v') {
+    unsigned N = cast<FixedVectorType>(LookupType(drv, Name))->getNumElements();
+    if (Args.size() != 1 && Args.size() != N)
+      return LogErrorV(drv, Name + " richiede 1 oppure " + std::to_string(N) + " argomenti");
+    for (auto arg : Args)
+      if (arg->getType() != D)
+        return LogErrorV(drv, "Le componenti di " + Name + " devono essere double");
+    if (Args.size() == 1)
+      return drv.builder->CreateVectorSplat(N, Args[0], Name);
+    Value *V = PoisonValue::get(FixedVectorType::get(D, N));
+    for (unsigned i=0; i<N; i++)
+      V = drv.builder->CreateInsertElement(V, Args[i], i, Name);
+    return V;
+  }
+  if (Args.size() != 1 || !Args[0]->getType()->isVectorTy())
+    return LogErrorV(drv, Name + " richiede un argomento vettoriale");
+  if (Name == "hsum")
+    return drv.builder->CreateFAddReduce(ConstantFP::getNegativeZero(D), Args[0]);
+  if (Name == "hmul")
+    return drv.builder->CreateFMulReduce(ConstantFP::get(D, 1.0), Args[0]);
+  if (Name == "hmin")
+    return drv.builder->CreateFPMinReduce(Args[0]);
+  return drv.builder->CreateFPMaxReduce(Args[0]);
+}
+
+// Operazione binaria sugli operandi già calcolati. Le operazioni
+// aritmetiche valgono anche fra vettori della stessa dimensione, componente
+// per componente; se uno solo degli operandi è un vettore, l'altro viene
+// replicato su tutte le componenti. I confronti sono solo fra scalari
+Value *BinaryOp(driver& drv, char Op, Value *L, Value *R) {
+  bool LV = L->getType()->isVectorTy(), RV = R->getType()->isVectorTy();
+  if (LV && RV && L->getType() != R->getType())
+    return LogErrorV(drv, "Operazione fra vettori di dimensioni diverse");
+  if (LV && !RV && R->getType()->isDoubleTy())
+    R = drv.builder->CreateVectorSplat(cast<FixedVectorType>(L->getType())->getNumElements(), R, "splat");
+  else if (RV && !LV && L->getType()->isDoubleTy())
+    L = drv.builder->CreateVectorSplat(cast<FixedVectorType>(R->getType())->getNumElements(), L, "splat");
+  if ((LV || RV) && (Op == '<' || Op == '='))
+    return LogErrorV(drv, "Confronto fra vettori non definito");
+  switch (Op) {
+  case '+':
+    return drv.builder->CreateFAdd(L,R,"addres");
+  case '-':
+    return drv.builder->CreateFSub(L,R,"subres");
+  case '*':
+    return drv.builder->CreateFMul(L,R,"mulres");
+  case '/':
+    return drv.builder->CreateFDiv(L,R,"addres");
+  case '<':
+    return drv.builder->CreateFCmpULT(L,R,"lttest");
+  case '=':
+    return drv.builder->CreateFCmpUEQ(L,R,"eqtest");
+  default:  
+    *drv.diag << Op << "\n";
+    return LogErrorV(drv, "operatore binario non corretto");
+  }
+}
+
+// Chiamata di CalleeF con gli argomenti già calcolati, di cui si controlla
+// il tipo (double o vettore, come dichiarato nel prototipo)
+Value *EmitCall(driver& drv, Function *CalleeF, std::vector<Value*>& ArgsV) {
+  for (unsigned i=0; i<ArgsV.size(); i++)
+    if (ArgsV[i]->getType() != CalleeF->getArg(i)->getType())
+      return LogErrorV(drv, "Argomento " + std::to_string(i+1) + " di " +
+                       CalleeF->getName().str() + " di tipo non corretto");
+  return drv.builder->CreateCall(CalleeF, ArgsV, "calltmp");
+}
+
 /********************* Number Expression Tree *********************/
 NumberExprAST::NumberExprAST(double Val): Val(Val) {};
 
@@ -80,7 +579,8 @@ lexval NumberExprAST::getLexVal() const {
 // che corrisponde al valore float memorizzato nel nodo
 
 Value *NumberExprAST::codegen(driver& drv) {  
-  return ConstantFP::get(*context, APFloat(Val));
+  drv.emitLocation(this);
+  return ConstantFP::get(*drv.context, APFloat(Val));
 };
 
 /******************** Variable Expression Tree ********************/
@@ -102,25 +602,33 @@ lexval VariableExprAST::getLexVal() const {
 // l'istruzione ma è anche il registro, vista la corrispodenza 1-1 fra le due nozioni), (3)
 // il nome del registro in cui verrà trasferito il valore dalla memoria
 Value *VariableExprAST::codegen(driver& drv) {
+  drv.emitLocation(this);
+  // Con -fssa le variabili locali non hanno un'area di memoria: il valore
+  // è la definizione corrente raggiungibile dal blocco di inserimento
+  if (drv.ssa) {
+    auto var = drv.SSAVars.find(Name);
+    if (var != drv.SSAVars.end())
+      return drv.readVariable(var->second, drv.builder->GetInsertBlock());
+  }
   AllocaInst *A = drv.NamedValues[Name];
   
   if (!A){
     //Se la variabile non è locale, si tenta di trovarla tra le globali
-    GlobalVariable* Global = module->getGlobalVariable(Name);
+    GlobalVariable* Global = drv.module->getGlobalVariable(Name);
 
     if(!Global){
       //se fallisce variabile non definita
-      return LogErrorV("Variabile "+Name+" non definita (ne localmente ne globalmente)");
+      return LogErrorV(drv, "Variabile "+Name+" non definita (ne localmente ne globalmente)");
     }
 
     else{
       //Viene trovata in globale, si crea la load
-      return builder->CreateLoad(Type::getDoubleTy(*context), Global, Name.c_str());
+      return drv.builder->CreateLoad(Type::getDoubleTy(*drv.context), Global, Name.c_str());
     }
 
   }
 
-  return builder->CreateLoad(A->getAllocatedType(), A, Name.c_str());
+  return drv.builder->CreateLoad(A->getAllocatedType(), A, Name.c_str());
 }
 
 /******************** Binary Expression Tree **********************/
@@ -132,13 +640,14 @@ BinaryExprAST::BinaryExprAST(char Ope, ExprAST* LHS, ExprAST* RHS):
 // operando. Con i valori memorizzati in altrettanti registri SSA si
 // costruisce l'istruzione utilizzando l'opportuno operatore
 Value *BinaryExprAST::codegen(driver& drv) {
+  drv.emitLocation(this);
   if (!LHS){
     //Caso in cui non sia definita un'operazione binaria. L'operazione è stata inserita nella seguente classe in quanto si tratta comunque di un'operazione tra "due operatori" di cui uno è "già specificato" (CreateFNeg crea una fsub tra un double pari a 0 e il Value*)
     switch(Ope){
       case '-':
-        return builder->CreateFNeg(RHS->codegen(drv), "neg");
+        return drv.builder->CreateFNeg(RHS->codegen(drv), "neg");
       default:
-        return LogErrorV("Attenzione! operazione non definita correttamente (LHS mancante e non si è nella operazione di negazione!)");
+        return LogErrorV(drv, "Attenzione! operazione non definita correttamente (LHS mancante e non si è nella operazione di negazione!)");
     }
 
   }
@@ -148,23 +657,10 @@ Value *BinaryExprAST::codegen(driver& drv) {
 
   if (!L || !R) 
      return nullptr;
-  switch (Ope) {
-  case '+':
-    return builder->CreateFAdd(L,R,"addres");
-  case '-':
-    return builder->CreateFSub(L,R,"subres");
-  case '*':
-    return builder->CreateFMul(L,R,"mulres");
-  case '/':
-    return builder->CreateFDiv(L,R,"addres");
-  case '<':
-    return builder->CreateFCmpULT(L,R,"lttest");
-  case '=':
-    return builder->CreateFCmpUEQ(L,R,"eqtest");
-  default:  
-    std::cout << Ope << std::endl;
-    return LogErrorV("operatore binario non corretto");
-  }
+  // Gli operandi hanno impostato le proprie posizioni: l'operazione
+  // va invece associata a quella dell'operatore
+  drv.emitLocation(this);
+  return BinaryOp(drv, Ope, L, R);
 };
 
 /********************* Call Expression Tree ***********************/
@@ -178,19 +674,31 @@ lexval CallExprAST::getLexVal() const {
 };
 
 Value* CallExprAST::codegen(driver& drv) {
+  // Costruttori e riduzioni dei vettori non sono funzioni del modulo
+  if (IsVectorBuiltin(Callee)) {
+    std::vector<Value *> ArgsV;
+    for (auto arg : Args) {
+      ArgsV.push_back(arg->codegen(drv));
+      if (!ArgsV.back())
+        return nullptr;
+    }
+    drv.emitLocation(this);
+    return VectorBuiltin(drv, Callee, ArgsV);
+  }
+
   // La generazione del codice corrispondente ad una chiamata di funzione
   // inizia cercando nel modulo corrente (l'unico, nel nostro caso) una funzione
   // il cui nome coincide con il nome memorizzato nel nodo dell'AST
   // Se la funzione non viene trovata (e dunque non è stata precedentemente definita)
   // viene generato un errore
 
-  Function *CalleeF = module->getFunction(Callee);
+  Function *CalleeF = drv.module->getFunction(Callee);
   if (!CalleeF)
-     return LogErrorV("Funzione "+Callee+" non definita");
+     return LogErrorV(drv, "Funzione "+Callee+" non definita");
   // Il secondo controllo è che la funzione recuperata abbia tanti parametri
   // quanti sono gi argomenti previsti nel nodo AST
   if (CalleeF->arg_size() != Args.size())
-     return LogErrorV("Numero di argomenti non corretto");
+     return LogErrorV(drv, "Numero di argomenti non corretto");
   // Passato con successo anche il secondo controllo, viene predisposta
   // ricorsivamente la valutazione degli argomenti presenti nella chiamata 
   // (si ricordi che gli argomenti possono essere espressioni arbitarie)
@@ -202,11 +710,37 @@ Value* CallExprAST::codegen(driver& drv) {
   for (auto arg : Args) {
      ArgsV.push_back(arg->codegen(drv));
      if (!ArgsV.back()){
-        std::cout<<"Errore qui!";
+        *drv.diag << "Errore qui!";
         return nullptr;
         }
   }
-  return builder->CreateCall(CalleeF, ArgsV, "calltmp");
+  drv.emitLocation(this);
+  return EmitCall(drv, CalleeF, ArgsV);
+}
+
+/********************* Index Expression Tree **********************/
+IndexExprAST::IndexExprAST(ExprAST* Vec, ExprAST* Index): Vec(Vec), Index(Index) {};
+
+// L'indice, come ogni valore, è un double e viene convertito in intero.
+// Un indice costante fuori dal vettore è un errore; uno calcolato durante
+// l'esecuzione non viene controllato (il risultato è indefinito)
+Value *IndexExprAST::codegen(driver& drv) {
+  Value *V = Vec->codegen(drv);
+  Value *I = Index->codegen(drv);
+  if (!V || !I)
+    return nullptr;
+  auto *VT = dyn_cast<FixedVectorType>(V->getType());
+  if (!VT)
+    return LogErrorV(drv, "Accesso con [] ad un valore non vettoriale");
+  drv.emitLocation(this);
+  if (auto *C = dyn_cast<ConstantFP>(I)) {
+    double idx = C->getValueAPF().convertToDouble();
+    if (idx < 0 || idx >= VT->getNumElements() || idx != (unsigned) idx)
+      return LogErrorV(drv, "Indice fuori dal vettore");
+    return drv.builder->CreateExtractElement(V, (uint64_t) idx, "elem");
+  }
+  return drv.builder->CreateExtractElement(V,
+      drv.builder->CreateFPToUI(I, drv.builder->getInt32Ty(), "idx"), "elem");
 }
 
 /************************* If Expression Tree *************************/
@@ -217,58 +751,65 @@ Value* IfExprAST::codegen(driver& drv) {
     // Viene dapprima generato il codice per valutare la condizione, che
     // memorizza il risultato (di tipo i1, dunque booleano) nel registro SSA 
     // che viene "memorizzato" in CondV. 
+    drv.emitLocation(this);
     Value* CondV = Cond->codegen(drv);
     if (!CondV)
-       return LogErrorV("Errore, non c'è la condizione per l'if!");
+       return LogErrorV(drv, "Errore, non c'è la condizione per l'if!");
     
     // Ora bisogna generare l'istruzione di salto condizionato, ma prima
     // vanno creati i corrispondenti basic block nella funzione attuale
     // (ovvero la funzione di cui fa parte il corrente blocco di inserimento)
-    Function *function = builder->GetInsertBlock()->getParent();
-    BasicBlock *TrueBB =  BasicBlock::Create(*context, "trueexp", function);
+    Function *function = drv.builder->GetInsertBlock()->getParent();
+    BasicBlock *TrueBB =  BasicBlock::Create(*drv.context, "trueexp", function);
     // Il blocco TrueBB viene inserito nella funzione dopo il blocco corrente
-    BasicBlock *FalseBB = BasicBlock::Create(*context, "falseexp");
-    BasicBlock *MergeBB = BasicBlock::Create(*context, "endcond");
+    BasicBlock *FalseBB = BasicBlock::Create(*drv.context, "falseexp");
+    BasicBlock *MergeBB = BasicBlock::Create(*drv.context, "endcond");
     
     //  l'istruzione di salto condizionato
-    builder->CreateCondBr(CondV, TrueBB, FalseBB);
+    drv.builder->CreateCondBr(CondV, TrueBB, FalseBB, BranchWeights(drv, Cond->branchHint()));
+    // Con -fssa: i due rami hanno un unico predecessore, già generato
+    drv.sealBlock(TrueBB);
+    drv.sealBlock(FalseBB);
     
     // "Posizioniamo" il builder all'inizio del blocco true, 
     // generiamo ricorsivamente il codice da eseguire in caso di
     // condizione vera, poi si genera il salto 
     // incondizionato al blocco merge
-    builder->SetInsertPoint(TrueBB);
+    drv.builder->SetInsertPoint(TrueBB);
     Value *TrueV = TrueExp->codegen(drv);
     if (!TrueV)
-       return LogErrorV("Impossibile generare il codice per la TrueExpr");
-    builder->CreateBr(MergeBB);
+       return LogErrorV(drv, "Impossibile generare il codice per la TrueExpr");
+    drv.builder->CreateBr(MergeBB);
     
     // Come già ricordato, la chiamata di codegen in TrueExp potrebbe aver inserito 
     // altri blocchi (nel caso in cui la parte trueexp sia a sua volta un condizionale).
     // Ne consegue che il blocco corrente potrebbe non coincidere più con TrueBB.
     // Il branch alla parte merge deve però essere effettuato dal blocco corrente,
     // che dunque va recuperato.
-    TrueBB = builder->GetInsertBlock();
+    TrueBB = drv.builder->GetInsertBlock();
     function->insert(function->end(), FalseBB);
     
     // "Posizioniamo" il builder all'inizio del blocco false, 
     // generiamo ricorsivamente il codice da eseguire in caso di
     // condizione falsa poi si genera il salto 
     // incondizionato al blocco merge
-    builder->SetInsertPoint(FalseBB);
+    drv.builder->SetInsertPoint(FalseBB);
     
     Value *FalseV = FalseExp->codegen(drv);  
     if (!FalseV)
        return nullptr;
-    builder->CreateBr(MergeBB);
+    drv.builder->CreateBr(MergeBB);
     
     // si recupera il blocco corrente 
-    FalseBB = builder->GetInsertBlock();
+    FalseBB = drv.builder->GetInsertBlock();
     function->insert(function->end(), MergeBB);
     
     //Generazioen del codice in cui i
     //flussi si riassestano. Si imposta il builder
-    builder->SetInsertPoint(MergeBB);
+    drv.builder->SetInsertPoint(MergeBB);
+    // Con -fssa: entrambi i predecessori del blocco merge sono noti; le
+    // variabili modificate nei rami riceveranno qui una PHI alla prima lettura
+    drv.sealBlock(MergeBB);
   
     // Il codice di riunione dei flussi è una "semplice" istruzione PHI: 
     //a seconda del blocco da cui arriva il flusso, TrueBB o FalseBB, il valore
@@ -279,7 +820,9 @@ Value* IfExprAST::codegen(driver& drv) {
     // 1) Dapprima si crea il nodo PHI specificando quanti sono i possibili nodi sorgente
     // 2) Per ogni possibile nodo sorgente, viene poi inserita l'etichetta e il registro
     //    SSA da cui prelevare il valore 
-    PHINode *PN = builder->CreatePHI(Type::getDoubleTy(*context), 2, "condval");
+    if (TrueV->getType() != FalseV->getType())
+       return LogErrorV(drv, "I due rami del condizionale hanno tipi diversi");
+    PHINode *PN = drv.builder->CreatePHI(TrueV->getType(), 2, "condval");
     PN->addIncoming(TrueV, TrueBB);
     PN->addIncoming(FalseV, FalseBB);
     return PN;
@@ -289,6 +832,24 @@ Value* IfExprAST::codegen(driver& drv) {
 BlockExprAST::BlockExprAST(std::vector<VarBindingAST*> Def, ExprAST* Val): 
          Def(std::move(Def)), Val(Val) {};
 
+// Scope lessicale DWARF di un blocco (con -g): aperto alla costruzione e
+// chiuso alla distruzione, quindi su ogni percorso di uscita da codegen,
+// compresi quelli di errore. Senza -g non fa nulla
+struct LexicalScope {
+  driver& drv;
+  bool open;
+  LexicalScope(driver& drv, const ExprAST *E): drv(drv),
+    open(drv.dbuilder && !drv.LexicalBlocks.empty()) {
+    if (open)
+      drv.LexicalBlocks.push_back(drv.dbuilder->createLexicalBlock(
+          drv.LexicalBlocks.back(), drv.dunit->getFile(), E->getLine(), E->getCol()));
+  };
+  ~LexicalScope() {
+    if (open)
+      drv.LexicalBlocks.pop_back();
+  };
+};
+
 Value* BlockExprAST::codegen(driver& drv) {
    // Un blocco è un'espressione preceduta dalla definizione di una o più variabili locali.
    // Le definizioni sono opzionali e tuttavia necessarie perché l'uso di un blocco
@@ -313,13 +874,48 @@ Value* BlockExprAST::codegen(driver& drv) {
    //    all'uscita del blocco. Questo è ciò che viene fatto dal presente codice, che utilizza
    //    al riguardo il vettore di appoggio "AllocaTmp" (che naturalmente è un vettore di
    //    di (puntatori ad) istruzioni di allocazione
+   // Con -g il blocco apre un nuovo scope lessicale DWARF, cui verranno
+   // associate sia le variabili definite sia le istruzioni del corpo
+   LexicalScope Scope(drv, this);
+   drv.emitLocation(this);
+   // Con -fssa le definizioni non allocano memoria: ad ogni nome viene
+   // associata una nuova variabile SSA, e all'uscita si ripristina quella
+   // esterna (se c'era), esattamente come per le alloca qui sotto
+   // (anche quando una definizione non può essere generata)
+   if (drv.ssa) {
+      std::vector<std::pair<bool,int>> VarTmp;
+      auto restore = [&]() {
+         for (int i=VarTmp.size()-1; i>=0; i--) {
+            if (VarTmp[i].first)
+               drv.SSAVars[Def[i]->getName()] = VarTmp[i].second;
+            else
+               drv.SSAVars.erase(Def[i]->getName());
+         }
+      };
+      for (auto def : Def) {
+         auto outer = drv.SSAVars.find(def->getName());
+         VarTmp.push_back(outer == drv.SSAVars.end() ? std::make_pair(false, 0)
+                                                    : std::make_pair(true, outer->second));
+         int var = def->codegenSSA(drv);
+         if (var < 0) {
+            restore();
+            return LogErrorV(drv, "Errore in BLockExpr1");
+         }
+         drv.SSAVars[def->getName()] = var;
+      }
+      Value *blockvalue = Val->codegen(drv);
+      restore();
+      if (!blockvalue)
+         return LogErrorV(drv, "Errore in BlockExpr");
+      return blockvalue;
+   }
    std::vector<AllocaInst*> AllocaTmp;
    for (int i=0, e=Def.size(); i<e; i++) {
       // Per ogni definizione di variabile si genera il corrispondente codice che
       // (in questo caso) non restituisce un registro SSA ma l'istruzione di allocazione
       AllocaInst *boundval = Def[i]->codegen(drv);
       if (!boundval)
-         return LogErrorV("Errore in BLockExpr1");
+         return LogErrorV(drv, "Errore in BLockExpr1");
       // Viene temporaneamente rimossa la precedente istruzione di allocazione
       // della stessa variabile (nome) e inserita quella corrente
       AllocaTmp.push_back(drv.NamedValues[Def[i]->getName()]);
@@ -331,7 +927,7 @@ Value* BlockExprAST::codegen(driver& drv) {
    // nella symbol table appena modificata
    Value *blockvalue = Val->codegen(drv);
       if (!blockvalue)
-         return LogErrorV("Errore in BlockExpr");
+         return LogErrorV(drv, "Errore in BlockExpr");
    // Prima di uscire dal blocco, si ripristina lo scope esterno al costrutto
    for (int i=0, e=Def.size(); i<e; i++) {
         drv.NamedValues[Def[i]->getName()] = AllocaTmp[i];
@@ -358,26 +954,53 @@ AllocaInst* VarBindingAST::codegen(driver& drv) {
    // di un parametro oppure di una variabile locale ad un blocco espressione)
    // viene sempre riservato nell'entry block della funzione. Ricordiamo che
    // l'allocazione viene fatta tramite l'utility CreateEntryBlockAlloca
-   Function *fun = builder->GetInsertBlock()->getParent();
+   Function *fun = drv.builder->GetInsertBlock()->getParent();
+   drv.emitLocation(this);
 
    // Ora viene generato il codice che definisce il valore della variabile
    Value *BoundVal = Val->codegen(drv);
    if (!BoundVal)  // Qualcosa è andato storto nella generazione del codice?
       return nullptr;
-   // Se tutto ok, si genera l'struzione che alloca memoria per la varibile ...
-   AllocaInst *Alloca = CreateEntryBlockAlloca(fun, Name);
+   // Se tutto ok, si genera l'struzione che alloca memoria per la varibile
+   // (del tipo del valore, double o vettore) ...
+   AllocaInst *Alloca = CreateEntryBlockAlloca(fun, Name, BoundVal->getType());
    // ... e si genera l'istruzione per memorizzarvi il valore dell'espressione,
    // ovvero il contenuto del registro BoundVal
-   builder->CreateStore(BoundVal, Alloca);
+   drv.builder->CreateStore(BoundVal, Alloca);
+
+   // Con -g la variabile viene descritta in DWARF e legata alla sua alloca
+   if (drv.dbuilder && !drv.LexicalBlocks.empty()) {
+      DILocalVariable *D = drv.dbuilder->createAutoVariable(drv.LexicalBlocks.back(),
+          Name, drv.dunit->getFile(), getLine(), drv.getDIType(BoundVal->getType()));
+      drv.dbuilder->insertDeclare(Alloca, D, drv.dbuilder->createExpression(),
+          DILocation::get(*drv.context, getLine(), getCol(), drv.LexicalBlocks.back()),
+          drv.builder->GetInsertBlock());
+   }
    
    // L'istruzione di allocazione (che include il registro "puntatore" all'area di memoria
    // allocata) viene restituita per essere inserita nella symbol table
    return Alloca;
 };
 
+// Variante per -fssa: nessuna alloca, il valore calcolato diventa la
+// definizione corrente di una nuova variabile nel blocco di inserimento.
+// Restituisce l'identificatore della variabile (-1 in caso di errore),
+// che il chiamante rende visibile con il nome della definizione
+int VarBindingAST::codegenSSA(driver& drv) {
+   drv.emitLocation(this);
+   Value *BoundVal = Val->codegen(drv);
+   if (!BoundVal)
+      return -1;
+   int var = drv.declareVariable(Name, BoundVal->getType());
+   drv.writeVariable(var, drv.builder->GetInsertBlock(), BoundVal);
+   return var;
+};
+
 /************************* Prototype Tree *************************/
-PrototypeAST::PrototypeAST(std::string Name, std::vector<std::string> Args):
-  Name(Name), Args(std::move(Args)), emitcode(true) {};  //Di regola il codice viene emesso
+PrototypeAST::PrototypeAST(std::string Name, std::vector<std::string> Args,
+                           std::vector<std::string> ArgTypes, std::string RetType):
+  Name(Name), Args(std::move(Args)), ArgTypes(std::move(ArgTypes)), RetType(RetType),
+  emitcode(true) {};  //Di regola il codice viene emesso
 
 lexval PrototypeAST::getLexVal() const {
    lexval lval = Name;
@@ -388,25 +1011,49 @@ const std::vector<std::string>& PrototypeAST::getArgs() const {
    return Args;
 };
 
+bool PrototypeAST::isTyped() const {
+   for (auto& T : ArgTypes)
+      if (!T.empty() && T != "double")
+         return true;
+   return !RetType.empty() && RetType != "double";
+};
+
 // Previene la doppia emissione del codice. Si veda il commento più avanti.
 void PrototypeAST::noemit() { 
    emitcode = false; 
 };
 
 Function *PrototypeAST::codegen(driver& drv) {
+  // I nomi dei costruttori e delle riduzioni vettoriali sono riservati
+  if (IsVectorBuiltin(Name)) {
+    LogErrorV(drv, "Il nome " + Name + " è riservato");
+    return nullptr;
+  }
   // Costruisce una struttura, qui chiamata FT, che rappresenta il "tipo" di una
   // funzione. Con ciò si intende a sua volta una coppia composta dal tipo
   // del risultato (valore di ritorno) e da un vettore che contiene il tipo di tutti
-  // i parametri. Si ricordi, tuttavia, che nel nostro caso l'unico tipo è double.
+  // i parametri. I tipi sono double, se non ne è indicato uno vettoriale.
   
-  // Prima definiamo il vettore (qui chiamato Doubles) con il tipo degli argomenti
-  std::vector<Type*> Doubles(Args.size(), Type::getDoubleTy(*context));
+  // Prima definiamo il vettore (qui chiamato Params) con il tipo degli argomenti
+  std::vector<Type*> Params;
+  for (unsigned i=0; i<Args.size(); i++) {
+    Params.push_back(LookupType(drv, i < ArgTypes.size() ? ArgTypes[i] : ""));
+    if (!Params.back()) {
+      LogErrorV(drv, "Tipo " + ArgTypes[i] + " del parametro " + Args[i] + " sconosciuto");
+      return nullptr;
+    }
+  }
+  Type *Ret = LookupType(drv, RetType);
+  if (!Ret) {
+    LogErrorV(drv, "Tipo " + RetType + " del risultato di " + Name + " sconosciuto");
+    return nullptr;
+  }
   // Quindi definiamo il tipo (FT) della funzione
-  FunctionType *FT = FunctionType::get(Type::getDoubleTy(*context), Doubles, false);
+  FunctionType *FT = FunctionType::get(Ret, Params, false);
   // Infine definiamo una funzione (al momento senza body) del tipo creato e con il nome
   // presente nel nodo AST. ExternalLinkage vuol dire che la funzione può avere
   // visibilità anche al di fuori del modulo
-  Function *F = Function::Create(FT, Function::ExternalLinkage, Name, *module);
+  Function *F = Function::Create(FT, Function::ExternalLinkage, Name, *drv.module);
 
   // Ad ogni parametro della funzione F (che, è bene ricordare, è la rappresentazione 
   // llvm di una funzione, non è una funzione C++) attribuiamo ora il nome specificato dal
@@ -424,10 +1071,8 @@ Function *PrototypeAST::codegen(driver& drv) {
      (come nel caso di funzione esterna) sia una definizione della stessa
      funzione.
   */
-  if (emitcode) {
-    F->print(errs());
-    fprintf(stderr, "\n");
-  };
+  if (emitcode)
+    drv.emit(F);
   
   return F;
 }
@@ -435,11 +1080,15 @@ Function *PrototypeAST::codegen(driver& drv) {
 /************************* Function Tree **************************/
 FunctionAST::FunctionAST(PrototypeAST* Proto, ExprAST* Body): Proto(Proto), Body(Body) {};
 
+PrototypeAST *FunctionAST::getProto() const {
+  return Proto;
+};
+
 Function* FunctionAST::codegen(driver& drv) {
   // Verifica che la funzione non sia già presente nel modulo, cioò che non
   // si tenti una "doppia definizion"
   Function *function = 
-      module->getFunction(std::get<std::string>(Proto->getLexVal()));
+      drv.module->getFunction(std::get<std::string>(Proto->getLexVal()));
   // Se la funzione non è già presente, si prova a definirla, innanzitutto
   // generando (ma non emettendo) il codice del prototipo
   if (!function){
@@ -452,8 +1101,25 @@ Function* FunctionAST::codegen(driver& drv) {
     return nullptr;  
 
   // Altrimenti si crea un blocco di base in cui iniziare a inserire il codice
-  BasicBlock *BB = BasicBlock::Create(*context, "entry", function);
-  builder->SetInsertPoint(BB);
+  BasicBlock *BB = BasicBlock::Create(*drv.context, "entry", function);
+  drv.builder->SetInsertPoint(BB);
+
+  // Con -g alla funzione viene associato un DISubprogram, che diventa lo
+  // scope più esterno per le posizioni delle istruzioni del corpo. Il prologo
+  // (allocazione dei parametri) non ha posizione nel sorgente
+  DISubprogram *SP = nullptr;
+  if (drv.dbuilder) {
+    DIFile *Unit = drv.dunit->getFile();
+    SmallVector<Metadata *, 8> EltTys(1, drv.getDIType(function->getReturnType()));
+    for (auto &Arg : function->args())
+      EltTys.push_back(drv.getDIType(Arg.getType()));
+    SP = drv.dbuilder->createFunction(Unit, function->getName(), StringRef(), Unit,
+        Proto->getLine(), drv.dbuilder->createSubroutineType(drv.dbuilder->getOrCreateTypeArray(EltTys)),
+        Body->getLine(), DINode::FlagPrototyped, DISubprogram::SPFlagDefinition);
+    function->setSubprogram(SP);
+    drv.LexicalBlocks.push_back(SP);
+    drv.emitLocation(nullptr);
+  }
  
   // Ora viene la parte "più delicata". Per ogni parametro formale della
   // funzione, nella symbol table si registra una coppia in cui la chiave
@@ -467,31 +1133,59 @@ Function* FunctionAST::codegen(driver& drv) {
   // Si noti che il builder conosce il registro che contiene il puntatore all'area
   // perché esso è parte della rappresentazione C++ dell'istruzione di allocazione
   // (variabile Alloca) 
+  // Con -fssa, invece, ogni parametro è direttamente la definizione iniziale
+  // della corrispondente variabile nel blocco di ingresso, che non avendo
+  // predecessori è subito "chiuso"
+  if (drv.ssa) {
+    drv.resetSSA();
+    drv.sealBlock(BB);
+  }
   
   for (auto &Arg : function->args()) {
+    if (drv.ssa) {
+      int var = drv.declareVariable(std::string(Arg.getName()), Arg.getType());
+      drv.writeVariable(var, BB, &Arg);
+      drv.SSAVars[std::string(Arg.getName())] = var;
+      continue;
+    }
     // Genera l'istruzione di allocazione per il parametro corrente
-    AllocaInst *Alloca = CreateEntryBlockAlloca(function, Arg.getName());
+    AllocaInst *Alloca = CreateEntryBlockAlloca(function, Arg.getName(), Arg.getType());
     // Genera un'istruzione per la memorizzazione del parametro nell'area
     // di memoria allocata
-    builder->CreateStore(&Arg, Alloca);
+    drv.builder->CreateStore(&Arg, Alloca);
     // Registra gli argomenti nella symbol table per eventuale riferimento futuro
     drv.NamedValues[std::string(Arg.getName())] = Alloca;
+    // Con -g il parametro viene descritto in DWARF e legato alla sua alloca
+    if (SP) {
+      DILocalVariable *D = drv.dbuilder->createParameterVariable(SP, Arg.getName(),
+          Arg.getArgNo() + 1, SP->getFile(), Proto->getLine(), drv.getDIType(Arg.getType()), true);
+      drv.dbuilder->insertDeclare(Alloca, D, drv.dbuilder->createExpression(),
+          DILocation::get(*drv.context, Proto->getLine(), 0, SP), drv.builder->GetInsertBlock());
+    }
   } 
   // Ora può essere generato il codice corssipondente al body (che potrà
   // fare riferimento alla symbol table)
 
-  if (Value *RetVal = Body->codegen(drv)) {
+  Value *RetVal = Body->codegen(drv);
+  if (RetVal && RetVal->getType() != function->getReturnType())
+    RetVal = LogErrorV(drv, "Il valore di " + function->getName().str() + " non è del tipo dichiarato");
+  if (SP)
+    drv.LexicalBlocks.pop_back();
+  if (RetVal) {
+    // Con -finstrument la misura dei cicli è aggiunta a corpo generato,
+    // quando se ne conosce la dimensione
+    if (drv.instrument)
+      drv.profFunction(function);
     // Se la generazione termina senza errori, ciò che rimane da fare è
     // di generare l'istruzione return, che ("a tempo di esecuzione") prenderà
     // il valore lasciato nel registro RetVal 
-    builder->CreateRet(RetVal);
+    drv.builder->CreateRet(RetVal);
 
     // Effettua la validazione del codice e un controllo di consistenza
     verifyFunction(*function);
  
-    // Emissione del codice su su stderr) 
-    function->print(errs());
-    fprintf(stderr, "\n");
+    // Emissione del codice (di default su stderr)
+    drv.emit(function);
 
     return function;
   }
@@ -510,13 +1204,17 @@ const std::string& VarGlobalAST::getName() const {
 };
 
 Value* VarGlobalAST::codegen(driver& drv) {
-  Type* doubleType = Type::getDoubleTy(*context);
+  Type* doubleType = Type::getDoubleTy(*drv.context);
 
   //Viene creata una nuova istanza della classe GlobalVariable built-in llvm.
-  GlobalVariable *globalVar = new GlobalVariable(*module, doubleType, false, GlobalValue::CommonLinkage, Constant::getNullValue(doubleType), Name);
+  GlobalVariable *globalVar = new GlobalVariable(*drv.module, doubleType, false, GlobalValue::CommonLinkage, Constant::getNullValue(doubleType), Name);
+
+   // Con -g la variabile globale viene descritta anche in DWARF
+   if (drv.dbuilder)
+     globalVar->addDebugInfo(drv.dbuilder->createGlobalVariableExpression(drv.dunit,
+         Name, Name, drv.dunit->getFile(), getLine(), drv.getDoubleDIType(), false));
 
-   globalVar->print(errs());
-   fprintf(stderr, "\n");
+   drv.emit(globalVar);
 
    return nullptr;
 };
@@ -526,14 +1224,15 @@ StmtAST::StmtAST(ExprAST* expression, ExprAST* statement)
   : Left(expression), Right(statement) {};
 
 Value* StmtAST::codegen(driver& drv) {
+  drv.emitLocation(this);
   Value* begin = Left->codegen(drv);
   
-  if (!begin) {return LogErrorV("Errore nel begin"); }
+  if (!begin) {return LogErrorV(drv, "Errore nel begin"); }
 
   if(Right){
     // Se è presente una parte destra bisogna ritornare il valore di ritorno della parte destra 
     Value* continuation = Right->codegen(drv);
-    if(!continuation){ return LogErrorV("Errore nel continuation"); }
+    if(!continuation){ return LogErrorV(drv, "Errore nel continuation"); }
     return continuation;
   }
   
@@ -543,54 +1242,80 @@ Value* StmtAST::codegen(driver& drv) {
 
 /************************* AssignmentAST *************************/
 AssignmentAST::AssignmentAST(std::string Name, ExprAST* Val = nullptr):
-   Name(Name), Val(Val) {};
+   Name(Name), Val(Val), Op('=') {};
 
 //Costruttore per gestire l'operatore '++'. Se l'espressione che si vuole valutare è ++i, allora viene invocato questo costruttore con passato come parametro '+'
 AssignmentAST::AssignmentAST(std::string Name, char op):
-   Name(Name), Op(op) {};
+   Name(Name), Val(nullptr), Op(op) {};
 
 const std::string& AssignmentAST::getName() const { 
    return Name; 
 };
 
 Value* AssignmentAST::codegen(driver& drv) {
+  drv.emitLocation(this);
+
+  // Con -fssa l'assegnamento ad una variabile locale non genera una store
+  // ma ne cambia la definizione corrente nel blocco di inserimento; il
+  // valore dell'assegnamento è il nuovo valore della variabile
+  if (drv.ssa) {
+    auto var = drv.SSAVars.find(Name);
+    if (var != drv.SSAVars.end()) {
+      Value *NewVal;
+      Type *T = drv.SSATypes[var->second];
+      if (Op == '+')
+        NewVal = drv.builder->CreateFAdd(drv.readVariable(var->second, drv.builder->GetInsertBlock()),
+                                         ConstantFP::get(T, 1.0), "inc");
+      else if (!(NewVal = Val->codegen(drv)))
+        return LogErrorV(drv, "Errore nel Val di AssignmentAST");
+      else if (NewVal->getType() != T)
+        return LogErrorV(drv, "Assegnamento a " + Name + " di un valore di tipo diverso");
+      drv.writeVariable(var->second, drv.builder->GetInsertBlock(), NewVal);
+      return NewVal;
+    }
+  }
    
   //Gestione dell'operatore '++'
   if (Op == '+'){
-    Function* fun = builder->GetInsertBlock()->getParent();
+    Function* fun = drv.builder->GetInsertBlock()->getParent();
 
     //Ovviamente la variabile deve essere definita dentro il contesto locale altrimenti non sarebbe possibile effettuare il for su una variabile non definita
-    Value* val = drv.NamedValues[Name];
-    if (!val) return LogErrorV("Variabile non definita");
+    AllocaInst* val = drv.NamedValues[Name];
+    if (!val) return LogErrorV(drv, "Variabile non definita");
     
     //Viene generata una nuova istruzione su un registro SSA per effettuare la somma del valore, poi memorizzato con una store
-    Value* Tmp = builder->CreateLoad(Type::getDoubleTy(*context), val, Name);
+    Value* Tmp = drv.builder->CreateLoad(val->getAllocatedType(), val, Name);
 
-    //somma
-    Value* One = builder->CreateFAdd(Tmp, ConstantFP::get(*context, APFloat(1.0)), "inc");
+    //somma (su tutte le componenti, per un vettore)
+    Value* One = drv.builder->CreateFAdd(Tmp, ConstantFP::get(val->getAllocatedType(), 1.0), "inc");
 
-    Value* Store = builder->CreateStore(One, val);
+    Value* Store = drv.builder->CreateStore(One, val);
     
-    return val;
+    return One;
   }
 
   //Se l'operatore non è '+', allora viene eseguita l'operazione di assegnazione
   Value *BoundVal = Val->codegen(drv);
   if (!BoundVal)
-    return LogErrorV("Errore nel Val di AssignmentAST");
+    return LogErrorV(drv, "Errore nel Val di AssignmentAST");
 
-   Value* val = drv.NamedValues[Name];
+   AllocaInst* val = drv.NamedValues[Name];
 
   if (!val){
-    GlobalVariable* Global = module->getGlobalVariable(Name);
+    GlobalVariable* Global = drv.module->getGlobalVariable(Name);
 
-    if(!Global) return LogErrorV("Variabile non definita!");
+    if(!Global) return LogErrorV(drv, "Variabile non definita!");
+    if (!BoundVal->getType()->isDoubleTy())
+      return LogErrorV(drv, "Assegnamento a " + Name + " di un valore di tipo diverso");
 
-    builder->CreateStore(BoundVal, Global);
-    return Global;
+    drv.builder->CreateStore(BoundVal, Global);
+    return BoundVal;
   }
-   builder->CreateStore(BoundVal, val);
-   return val;
+   if (BoundVal->getType() != val->getAllocatedType())
+     return LogErrorV(drv, "Assegnamento a " + Name + " di un valore di tipo diverso");
+   drv.builder->CreateStore(BoundVal, val);
+   // Come con -fssa, il valore dell'assegnamento è il valore assegnato
+   return BoundVal;
 };
 
 /************************* For Expression Tree *************************/
@@ -600,6 +1325,7 @@ ForExprAST::ForExprAST(std::variant<VarBindingAST*, AssignmentAST*> start, ExprA
    Start(start), Cond(cond), Step(step), Body(body) {};
    
 Value* ForExprAST::codegen(driver& drv) {
+  drv.emitLocation(this);
   
   //La variabile start può essere o un VarBinding o un Assignment in quanto dipende se la variabile è già stata definita nel contesto o meno. Se già stata definita, 
   //recupero il tipo AssignmentAST dal variant start, viceversa recupero il tipo VarBindingAST. 
@@ -611,65 +1337,117 @@ Value* ForExprAST::codegen(driver& drv) {
     VarName = std::get<AssignmentAST*>(Start)->getName();
   else return nullptr;
 
-  AllocaInst* AllocaTmp;
-
-  //Se viene trovata la variabile, viene memorizzata
-  if (drv.NamedValues[VarName] != nullptr){
-    AllocaTmp = drv.NamedValues[VarName];
-  }
+  // Se il contatore è introdotto con var, è una nuova variabile visibile
+  // solo nel ciclo: all'uscita si ripristina quella esterna con lo stesso
+  // nome (se c'era), come per i blocchi. Altrimenti l'assegnamento iniziale
+  // aggiorna la variabile esistente, e viene sempre eseguito.
+  // Con -fssa il contatore è una variabile SSA invece di un'alloca
+  AllocaInst* AllocaTmp = nullptr;
+  std::optional<int> OuterVar;
+  if (std::holds_alternative<VarBindingAST*>(Start)) {
+    if (drv.ssa) {
+      auto outer = drv.SSAVars.find(VarName);
+      if (outer != drv.SSAVars.end())
+        OuterVar = outer->second;
+      int var = std::get<VarBindingAST*>(Start)->codegenSSA(drv);
+      if (var < 0) return nullptr;
+      drv.SSAVars[VarName] = var;
+    } else {
+      AllocaTmp = drv.NamedValues[VarName];
+      AllocaInst* Alloca = std::get<VarBindingAST*>(Start)->codegen(drv);
+      if (!Alloca) return nullptr;
+      drv.NamedValues[VarName] = Alloca;
+    }
+  } else if (!std::get<AssignmentAST*>(Start)->codegen(drv))
+    return nullptr;
 
-  //altrimenti viene generata
-  else {
-    if (std::holds_alternative<VarBindingAST*>(Start))
-      drv.NamedValues[VarName] = std::get<VarBindingAST*>(Start)->codegen(drv);
-    else if (std::holds_alternative<AssignmentAST*>(Start))
-      drv.NamedValues[VarName] = std::get<VarBindingAST*>(Start)->codegen(drv);
+  Function* function = drv.builder->GetInsertBlock()->getParent();
+
+  // Con -finstrument le iterazioni sono contate in una variabile locale
+  // (una variabile SSA con -fssa) e comunicate al runtime una sola volta,
+  // all'uscita dal ciclo
+  Value *ProfSite = nullptr;
+  AllocaInst *ProfTrips = nullptr;
+  int ProfTripsVar = -1;
+  if (drv.instrument) {
+    ProfSite = drv.profSite('L', function->getName().str() + ":" + std::to_string(getLine()));
+    if (drv.ssa) {
+      ProfTripsVar = drv.declareVariable("prof.trips", drv.builder->getInt64Ty());
+      drv.writeVariable(ProfTripsVar, drv.builder->GetInsertBlock(), drv.builder->getInt64(0));
+    } else {
+      ProfTrips = CreateEntryBlockAlloca(function, "prof.trips", drv.builder->getInt64Ty());
+      drv.builder->CreateStore(drv.builder->getInt64(0), ProfTrips);
+    }
   }
 
-  Function* function = builder->GetInsertBlock()->getParent();
-  AllocaInst *Alloca = CreateEntryBlockAlloca(function, VarName);
-
   //Seguono una serie di istruzioni simili per l'if
-  BasicBlock* CondBB = BasicBlock::Create(*context, "cond", function);
-  BasicBlock* LoopBB = BasicBlock::Create(*context, "loop");
-  BasicBlock* MergeBB = BasicBlock::Create(*context, "merge");
+  BasicBlock* CondBB = BasicBlock::Create(*drv.context, "cond", function);
+  BasicBlock* LoopBB = BasicBlock::Create(*drv.context, "loop");
+  BasicBlock* MergeBB = BasicBlock::Create(*drv.context, "merge");
 
-  builder->CreateBr(CondBB);
+  drv.builder->CreateBr(CondBB);
 
-  builder->SetInsertPoint(CondBB);
+  // Il blocco di intestazione (destinazione del salto all'indietro) va
+  // ricordato: la condizione può generare altri blocchi (and/or in
+  // cortocircuito) e CondBB viene poi aggiornato all'ultimo di essi.
+  // Con -fssa l'intestazione resta "aperta" fino al salto all'indietro:
+  // le variabili lette nella condizione ricevono PHI incomplete
+  BasicBlock* HeaderBB = CondBB;
+  drv.builder->SetInsertPoint(CondBB);
 
   //Blocco condizione
   Value* CondV = Cond->codegen(drv);
     if (!CondV) return nullptr;
   
-  CondBB = builder->GetInsertBlock();
+  CondBB = drv.builder->GetInsertBlock();
   function->insert(function->end(), LoopBB);
   
   //Codice per il salto condizionato
-  builder->CreateCondBr(CondV, LoopBB, MergeBB);
+  drv.builder->CreateCondBr(CondV, LoopBB, MergeBB, BranchWeights(drv, Cond->branchHint()));
+  drv.sealBlock(LoopBB);
+  drv.sealBlock(MergeBB);
 
   //Blocco Loop
-  builder->SetInsertPoint(LoopBB);
+  drv.builder->SetInsertPoint(LoopBB);
+  if (ProfTrips) {
+    Value *Trips = drv.builder->CreateLoad(drv.builder->getInt64Ty(), ProfTrips, "prof.trips");
+    drv.builder->CreateStore(drv.builder->CreateAdd(Trips, drv.builder->getInt64(1)), ProfTrips);
+  } else if (ProfTripsVar >= 0) {
+    Value *Trips = drv.readVariable(ProfTripsVar, LoopBB);
+    drv.writeVariable(ProfTripsVar, LoopBB, drv.builder->CreateAdd(Trips, drv.builder->getInt64(1)));
+  }
   Value* BodyV = Body->codegen(drv);
     if (!BodyV) return nullptr;
   Value* StepV = Step->codegen(drv);
     if (!StepV) return nullptr;
 
-  LoopBB = builder->GetInsertBlock();
-  builder->CreateBr(CondBB);
+  LoopBB = drv.builder->GetInsertBlock();
+  drv.builder->CreateBr(HeaderBB);
+  drv.sealBlock(HeaderBB);
 
   function->insert(function->end(), MergeBB);
 
   //insert del blocco Merge
-  builder->SetInsertPoint(MergeBB);
-
-  //Se è stato usato un AllocaTmp, viene inserito il valore dentro la variabile VarName, in quanto deve essere aggiornato nel caso la variabile non sia stata definita "in loco", ma fosse già presente in memoria.
-  if (AllocaTmp){
-    drv.NamedValues[VarName] = AllocaTmp;
+  drv.builder->SetInsertPoint(MergeBB);
+  if (ProfSite) {
+    FunctionCallee ProfLoop = drv.module->getOrInsertFunction("__kprof_loop",
+        drv.builder->getVoidTy(), drv.builder->getInt32Ty(), drv.builder->getInt64Ty());
+    drv.builder->CreateCall(ProfLoop, {ProfSite, ProfTrips
+        ? drv.builder->CreateLoad(drv.builder->getInt64Ty(), ProfTrips, "prof.trips")
+        : drv.readVariable(ProfTripsVar, MergeBB)});
   }
 
-  return function;
+  if (std::holds_alternative<VarBindingAST*>(Start)) {
+    if (!drv.ssa)
+      drv.NamedValues[VarName] = AllocaTmp;
+    else if (OuterVar)
+      drv.SSAVars[VarName] = *OuterVar;
+    else
+      drv.SSAVars.erase(VarName);
+  }
 
+  // Come istruzione, il ciclo vale 0 (in entrambe le modalità)
+  return ConstantFP::get(*drv.context, APFloat(0.0));
 };
 
 /******************** CreateCondExp **********************/
@@ -677,27 +1455,76 @@ CondExprAST::CondExprAST(char Op, ExprAST* LHS, ExprAST* RHS):
   Op(Op), LHS(LHS), RHS(RHS) {};
 
 CondExprAST::CondExprAST(char Op, ExprAST* RHS):
-  Op(Op), RHS(RHS) {};
+  Op(Op), LHS(nullptr), RHS(RHS) {};
 
+// Le annotazioni likely(...) e unlikely(...) sono nodi unari con operatore
+// 'L' e 'U'; la negazione inverte l'annotazione dell'operando
+int CondExprAST::branchHint() const {
+  switch (Op) {
+  case 'L':
+    return 1;
+  case 'U':
+    return -1;
+  case '!':
+    return -RHS->branchHint();
+  default:
+    return 0;
+  }
+};
 
 Value *CondExprAST::codegen(driver& drv) {
+  drv.emitLocation(this);
 
   //Caso specifico dell'operatore NOT, che non presenta una parte sinistra 
-  if (!LHS && Op == '!')
-    return builder->CreateNot(RHS->codegen(drv),"not");
+  if (!LHS && Op == '!') {
+    Value *R = RHS->codegen(drv);
+    if (!R)
+       return nullptr;
+    return drv.builder->CreateNot(R,"not");
+  }
 
+  // likely/unlikely non generano codice: l'annotazione viene letta
+  // (tramite branchHint) da chi genera il salto condizionato
+  if (!LHS && (Op == 'L' || Op == 'U'))
+    return RHS->codegen(drv);
+
+  if (Op != '&' && Op != '|') {
+    *drv.diag << Op << "\n";
+    return LogErrorV(drv, "Operatore di condizione non definito!");
+  }
+
+  // and e or sono valutati in cortocircuito, con uno schema analogo a
+  // quello di IfExprAST: l'operando destro viene valutato in un blocco
+  // separato, raggiunto solo se il sinistro non basta a decidere il
+  // risultato (vero per and, falso per or). Nel blocco di riunione una
+  // PHI seleziona il valore: la costante decisa dal sinistro oppure il
+  // valore del destro
   Value *L = LHS->codegen(drv);
-  Value *R = RHS->codegen(drv);
+  if (!L)
+     return nullptr;
+  Function *function = drv.builder->GetInsertBlock()->getParent();
+  BasicBlock *LhsBB = drv.builder->GetInsertBlock();
+  BasicBlock *RhsBB = BasicBlock::Create(*drv.context, Op == '&' ? "and.rhs" : "or.rhs", function);
+  BasicBlock *MergeBB = BasicBlock::Create(*drv.context, Op == '&' ? "and.end" : "or.end");
+  if (Op == '&')
+    drv.builder->CreateCondBr(L, RhsBB, MergeBB, BranchWeights(drv, LHS->branchHint()));
+  else
+    drv.builder->CreateCondBr(L, MergeBB, RhsBB, BranchWeights(drv, LHS->branchHint()));
+  drv.sealBlock(RhsBB);
 
-  if (!L || !R) 
+  drv.builder->SetInsertPoint(RhsBB);
+  Value *R = RHS->codegen(drv);
+  if (!R)
      return nullptr;
-  switch (Op) {
-  case '&':
-    return builder->CreateAnd(L,R,"and");
-  case '|':
-    return builder->CreateOr(L,R,"or");
-  default:  
-    std::cout << Op << std::endl;
-    return LogErrorV("Operatore di condizione non definito!");
-  }
-};
\ No newline at end of file
+  drv.builder->CreateBr(MergeBB);
+  // Come in IfExprAST, il codice del destro può aver creato altri blocchi
+  RhsBB = drv.builder->GetInsertBlock();
+
+  function->insert(function->end(), MergeBB);
+  drv.builder->SetInsertPoint(MergeBB);
+  drv.sealBlock(MergeBB);
+  PHINode *PN = drv.builder->CreatePHI(Type::getInt1Ty(*drv.context), 2, Op == '&' ? "and" : "or");
+  PN->addIncoming(drv.builder->getInt1(Op == '|'), LhsBB);
+  PN->addIncoming(R, RhsBB);
+  return PN;
+};
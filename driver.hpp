@@ -4,18 +4,24 @@
 #include "llvm/ADT/APFloat.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/DIBuilder.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/ModuleSlotTracker.h"
 #include "llvm/IR/Type.h"
+#include "llvm/IR/ValueHandle.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Support/raw_ostream.h"
 /**************** C++ modules and generic data types ***********************/
 #include <cstdio>
+#include <optional>
 #include <variant>
 #include <cstdlib>
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -25,17 +31,31 @@ using namespace llvm;
 
 // Dichiarazione del prototipo yylex per Flex
 // Flex va proprio a cercare YY_DECL perché
-// deve espanderla (usando M4) nel punto appropriato
+// deve espanderla (usando M4) nel punto appropriato.
+// Lo scanner è rientrante: il suo stato (yyscan_t, ovvero void*)
+// è passato esplicitamente come secondo parametro
 # define YY_DECL \
-  yy::parser::symbol_type yylex (driver& drv)
+  yy::parser::symbol_type yylex (driver& drv, void* yyscanner)
 // Per il parser è sufficiente una forward declaration
 YY_DECL;
 
+class FlatAST;
+class Evaluator;
+
 // Classe che organizza e gestisce il processo di compilazione
 class driver
 {
 public:
-  driver();
+  driver(LLVMContext *ctx = nullptr);
+  ~driver();
+  void setOptions(const driver& opts);
+  bool owncontext;      // Il contesto è stato creato (e va distrutto) dal driver
+  LLVMContext *context; // Contesto, modulo e builder sono propri di ciascun
+  Module *module;       // driver (non globali), così che più file possano
+  IRBuilder<> *builder; // essere compilati in parallelo nello stesso processo
+  raw_ostream *out;     // Destinazione del codice IR emesso (default stderr)
+  raw_ostream *diag;    // Destinazione dei messaggi di errore (default stderr)
+  unsigned errors;      // Errori di codegen segnalati (con LogErrorV)
   std::map<std::string, AllocaInst*> NamedValues; // Tabella associativa in cui ogni 
             // chiave x è una variabile e il cui corrispondente valore è un'istruzione 
             // che alloca uno spazio di memoria della dimensione necessaria per 
@@ -43,24 +63,122 @@ public:
   RootAST* root;      // A fine parsing "punta" alla radice dell'AST
   int parse (const std::string& f);
   std::string file;
+  // Con il compile server i sorgenti arrivano in memoria insieme alla
+  // richiesta e i file prodotti vi tornano allo stesso modo: se sources
+  // non è nullo parse legge da lì (e solo da lì) il testo del file; se
+  // outputs non è nullo writeFile vi raccoglie i file anziché scriverli
+  const std::map<std::string, std::string>* sources;
+  std::map<std::string, std::string>* outputs;
+  const std::string* source; // Testo del file in analisi, se in memoria
+  std::string cwd;      // Directory dei percorsi relativi (vuota: quella del processo)
+  std::string path() const; // Percorso da aprire per file (relativo a cwd)
+  bool writeFile (const std::string& name, StringRef data) const;
   bool trace_parsing; // Abilita le tracce di debug el parser
-  void scan_begin (); // Implementata nello scanner
+  bool scan_begin (); // Implementata nello scanner
   void scan_end ();   // Implementata nello scanner
   bool trace_scanning;// Abilita le tracce di debug nello scanner
+  void* scanner;      // Stato dello scanner rientrante (yyscan_t)
   yy::location location; // Utillizata dallo scannar per localizzare i token
-  void codegen();
+  bool debug_info;    // Genera le informazioni di debug DWARF (opzione -g)
+  bool emit_module;   // Emette il modulo per intero a fine codegen anziché
+                      // una definizione alla volta (necessario con -g, perché
+                      // i metadati sono completi solo dopo la finalizzazione)
+  void emit(GlobalObject *GO);  // Emissione di una singola definizione
+  ModuleSlotTracker *slots;     // Numerazione dei metadati fra le definizioni
+  std::set<MDNode*> emittedMD;  // Metadati la cui definizione è già stata emessa
+  std::set<Function*> emittedIntrinsics; // Intrinseci già dichiarati
+  DIBuilder *dbuilder;          // Costruttore dei metadati di debug (solo con -g)
+  DICompileUnit *dunit;         // Compile unit del file corrente
+  std::vector<DIScope*> LexicalBlocks; // Pila degli scope (funzioni e blocchi)
+  DIType *getDoubleDIType();
+  DIType *getDIType(Type *T);   // Tipo DWARF di double o di un vettore
+  void emitLocation(RootAST *AST);
+  bool instrument;    // Strumentazione per il profiling (opzione -finstrument)
+  unsigned instrument_min; // Istruzioni IR sotto le quali una funzione non è
+                           // strumentata (opzione -finstrument=N)
+  std::vector<std::string> ProfSites; // Nomi dei siti strumentati del modulo
+  std::string ProfKinds;        // Tipo di ogni sito: 'F' funzione, 'L' ciclo
+  GlobalVariable *ProfBase;     // Indice assegnato dal runtime al primo sito
+  Value *profSite(char kind, const std::string& name);
+  void profFunction(Function *function);
+  void emitProfRegistration();
+  // Costruzione diretta della forma SSA (opzione -fssa), secondo l'algoritmo
+  // "on the fly" di Braun et al.: le variabili locali non passano per la
+  // memoria (alloca/load/store) ma per la definizione corrente in ogni
+  // blocco; le PHI vengono inserite ai punti di confluenza quando servono.
+  // Ogni variabile è identificata da un intero, così che una ridefinizione
+  // dello stesso nome in un blocco annidato sia una variabile distinta
+  bool ssa;
+  std::map<std::string, int> SSAVars;  // Variabile visibile per ciascun nome
+  std::vector<std::string> SSANames;   // Nome e tipo di ciascuna variabile
+  std::vector<Type*> SSATypes;
+  std::map<BasicBlock*, std::map<int, WeakTrackingVH>> CurrentDef;
+  std::map<BasicBlock*, std::map<int, PHINode*>> IncompletePhis;
+  std::set<BasicBlock*> SealedBlocks;  // Blocchi con tutti i predecessori noti
+  void resetSSA();
+  int declareVariable(const std::string& name, Type *T);
+  void writeVariable(int var, BasicBlock *BB, Value *V);
+  Value *readVariable(int var, BasicBlock *BB);
+  void sealBlock(BasicBlock *BB);
+  uint64_t fold;      // Passi di valutazione a disposizione di ogni definizione
+                      // per il folding delle costanti (opzione -ffold, si veda
+                      // eval.hpp); 0 se il folding non è richiesto
+  Evaluator *folder;  // Valutatore di -ffold durante codegen (si veda SeqAST::codegen)
+private:
+  Value *readVariableRecursive(int var, BasicBlock *BB);
+  Value *addPhiOperands(int var, PHINode *Phi);
+  Value *tryRemoveTrivialPhi(PHINode *Phi);
+public:
+  int codegen();
 };
 
+// Il parser invoca yylex(drv): lo stato dello scanner è quello del driver
+inline yy::parser::symbol_type yylex (driver& drv) {
+  return yylex(drv, drv.scanner);
+}
+
+// Utility di generazione del codice (BinaryOp e IsVectorBuiltin sono usate
+// anche dal valutatore e dall'AST compatto)
+Value *LogErrorV(driver& drv, const std::string Str);
+AllocaInst *CreateEntryBlockAlloca(Function *fun, StringRef VarName, Type* T = nullptr);
+MDNode *BranchWeights(driver& drv, int hint);
+Value *BinaryOp(driver& drv, char Op, Value *L, Value *R);
+Value *EmitCall(driver& drv, Function *CalleeF, std::vector<Value*>& ArgsV);
+// Tipi vettoriali: vec2, vec4 e vec8 sono <N x double>. I nomi dei
+// costruttori (vec2(...), ...) e delle riduzioni orizzontali (hsum, hmul,
+// hmin, hmax) sono riservati e prevalgono su funzioni con lo stesso nome
+Type *LookupType(driver& drv, const std::string& name);
+bool IsVectorBuiltin(const std::string& name);
+
 typedef std::variant<std::string,double> lexval;
 const lexval NONE = 0.0;
 
 // Classe base dell'intera gerarchia di classi che rappresentano
 // gli elementi del programma
 class RootAST {
+protected:
+  yy::location Loc;   // Posizione nel sorgente, impostata dal parser
 public:
   virtual ~RootAST() {};
   virtual lexval getLexVal() const {return NONE;};
   virtual Value *codegen(driver& drv) { return nullptr; };
+  // Aggiunge il sottoalbero all'AST compatto e ne restituisce l'indice;
+  // i nodi senza una rappresentazione compatta vi compaiono come "rinvio"
+  // al nodo originale (si veda flatast.cpp)
+  virtual uint32_t flatten(FlatAST& flat);
+  // Numero di nodi del sottoalbero: la stessa visita che bench/flatbench
+  // esegue sull'AST compatto, per confrontarne il costo
+  virtual uint64_t countNodes() { return 1; };
+  // Valore del sottoalbero calcolato senza generare codice, nullopt se non
+  // è calcolabile (si veda eval.cpp)
+  virtual std::optional<double> eval(Evaluator& ev) { return std::nullopt; };
+  // Folding delle costanti nel sottoalbero: restituisce il nodo da usare
+  // al posto di questo
+  virtual RootAST *fold(Evaluator& ev) { return this; };
+  void setLocation(const yy::location& l) { Loc = l; };
+  const yy::location& getLocation() const { return Loc; };
+  int getLine() const { return Loc.begin.line; };
+  int getCol() const { return Loc.begin.column; };
 };
 
 // Classe che rappresenta la sequenza di statement
@@ -72,10 +190,24 @@ private:
 public:
   SeqAST(RootAST* first, RootAST* continuation);
   Value *codegen(driver& drv) override;
+  uint32_t flatten(FlatAST& flat) override;
+  uint64_t countNodes() override;
+  std::optional<double> eval(Evaluator& ev) override;
+  RootAST *fold(Evaluator& ev) override;
 };
 
 /// ExprAST - Classe base per tutti i nodi espressione
-class ExprAST : public RootAST {};
+class ExprAST : public RootAST {
+public:
+  // Annotazione di probabilità della condizione: 1 likely, -1 unlikely,
+  // 0 nessuna (usata per i pesi dei salti condizionati)
+  virtual int branchHint() const { return 0; };
+  // Il valore è un double? Non lo sono i confronti e gli operatori logici
+  // (i1), gli assegnamenti e i cicli. Solo un nodo con valore double può
+  // essere sostituito da una costante
+  virtual bool numeric() const { return true; };
+  ExprAST *fold(Evaluator& ev) override { return this; };
+};
 
 /// NumberExprAST - Classe per la rappresentazione di costanti numeriche
 class NumberExprAST : public ExprAST {
@@ -86,6 +218,8 @@ public:
   NumberExprAST(double Val);
   lexval getLexVal() const override;
   Value *codegen(driver& drv) override;
+  uint32_t flatten(FlatAST& flat) override;
+  std::optional<double> eval(Evaluator& ev) override;
 };
 
 /// VariableExprAST - Classe per la rappresentazione di riferimenti a variabili
@@ -97,6 +231,8 @@ public:
   VariableExprAST(const std::string &Name);
   lexval getLexVal() const override;
   Value *codegen(driver& drv) override;
+  uint32_t flatten(FlatAST& flat) override;
+  std::optional<double> eval(Evaluator& ev) override;
 };
 
 /// BinaryExprAST - Classe per la rappresentazione di operatori binari
@@ -109,6 +245,11 @@ private:
 public:
   BinaryExprAST(char Op, ExprAST* LHS, ExprAST* RHS);
   Value *codegen(driver& drv) override;
+  uint32_t flatten(FlatAST& flat) override;
+  uint64_t countNodes() override;
+  std::optional<double> eval(Evaluator& ev) override;
+  ExprAST *fold(Evaluator& ev) override;
+  bool numeric() const override;
 };
 
 /// CallExprAST - Classe per la rappresentazione di chiamate di funzione
@@ -121,6 +262,22 @@ public:
   CallExprAST(std::string Callee, std::vector<ExprAST*> Args);
   lexval getLexVal() const override;
   Value *codegen(driver& drv) override;
+  uint32_t flatten(FlatAST& flat) override;
+  uint64_t countNodes() override;
+  std::optional<double> eval(Evaluator& ev) override;
+  ExprAST *fold(Evaluator& ev) override;
+};
+
+/// IndexExprAST - Classe per l'accesso ad una componente di un vettore (v[i])
+class IndexExprAST : public ExprAST {
+private:
+  ExprAST* Vec;
+  ExprAST* Index;
+
+public:
+  IndexExprAST(ExprAST* Vec, ExprAST* Index);
+  Value *codegen(driver& drv) override;
+  ExprAST *fold(Evaluator& ev) override;
 };
 
 /// IfExprAST
@@ -132,6 +289,11 @@ private:
 public:
   IfExprAST(ExprAST* Cond, ExprAST* TrueExp, ExprAST* FalseExp);
   Value *codegen(driver& drv) override;
+  uint32_t flatten(FlatAST& flat) override;
+  uint64_t countNodes() override;
+  std::optional<double> eval(Evaluator& ev) override;
+  ExprAST *fold(Evaluator& ev) override;
+  bool numeric() const override;
 };
 
 /// BlockExprAST
@@ -142,6 +304,11 @@ private:
 public:
   BlockExprAST(std::vector<VarBindingAST*> Def, ExprAST* Val);
   Value *codegen(driver& drv) override;
+  uint32_t flatten(FlatAST& flat) override;
+  uint64_t countNodes() override;
+  std::optional<double> eval(Evaluator& ev) override;
+  ExprAST *fold(Evaluator& ev) override;
+  bool numeric() const override;
 }; 
 
 /// VarBindingAST
@@ -155,6 +322,11 @@ public:
   VarBindingAST(const std::string Name, ExprAST* Val);
   VarBindingAST(const std::string Name, double Max, std::vector<ExprAST*> ArrVal);
   AllocaInst *codegen(driver& drv) override;
+  uint32_t flatten(FlatAST& flat) override;
+  uint64_t countNodes() override;
+  std::optional<double> eval(Evaluator& ev) override;
+  VarBindingAST *fold(Evaluator& ev) override;
+  int codegenSSA(driver& drv);
   const std::string& getName() const;
 };
 
@@ -165,13 +337,20 @@ class PrototypeAST : public RootAST {
 private:
   std::string Name;
   std::vector<std::string> Args;
+  std::vector<std::string> ArgTypes;  // Tipi dei parametri ("" se double)
+  std::string RetType;                // Tipo del risultato ("" se double)
   bool emitcode;
 
 public:
-  PrototypeAST(std::string Name, std::vector<std::string> Args);
+  PrototypeAST(std::string Name, std::vector<std::string> Args,
+               std::vector<std::string> ArgTypes = {}, std::string RetType = "");
   const std::vector<std::string> &getArgs() const;
+  bool isTyped() const;               // Qualche tipo diverso da double?
   lexval getLexVal() const override;
   Function *codegen(driver& drv) override;
+  uint32_t flatten(FlatAST& flat) override;
+  std::optional<double> eval(Evaluator& ev) override;
+  RootAST *fold(Evaluator& ev) override;
   void noemit();
 };
 
@@ -185,8 +364,15 @@ private:
 public:
   FunctionAST(PrototypeAST* Proto, ExprAST* Body);
   Function *codegen(driver& drv) override;
+  uint32_t flatten(FlatAST& flat) override;
+  uint64_t countNodes() override;
+  std::optional<double> eval(Evaluator& ev) override;
+  RootAST *fold(Evaluator& ev) override;
+  PrototypeAST *getProto() const;
+  // Valore della funzione applicata ad args, calcolato da ev
+  std::optional<double> apply(Evaluator& ev, const std::vector<double>& args);
 };
-*
+
 class VarGlobalAST : public RootAST {
   private: 
   std::string Name;
@@ -195,6 +381,8 @@ class VarGlobalAST : public RootAST {
 public:
   VarGlobalAST(const std::string &Name);
   Value* codegen(driver& drv) override;
+  uint32_t flatten(FlatAST& flat) override;
+  std::optional<double> eval(Evaluator& ev) override;
   const std::string& getName() const;
 };
 
@@ -208,6 +396,11 @@ public:
   AssignmentAST(const std::string Name, ExprAST* Val);
   AssignmentAST(const std::string Name, char op);
   Value* codegen(driver& drv) override;
+  uint32_t flatten(FlatAST& flat) override;
+  uint64_t countNodes() override;
+  std::optional<double> eval(Evaluator& ev) override;
+  ExprAST *fold(Evaluator& ev) override;
+  bool numeric() const override;
   const std::string& getName() const;
 };
 
@@ -219,10 +412,13 @@ class StmtAST : public ExprAST {
   public:
     StmtAST(ExprAST* Expression, ExprAST* Statement);
     Value* codegen(driver& drv) override;
+    uint32_t flatten(FlatAST& flat) override;
+    uint64_t countNodes() override;
+    std::optional<double> eval(Evaluator& ev) override;
+    ExprAST *fold(Evaluator& ev) override;
+    bool numeric() const override;
 };
 
-#endif // ! DRIVER_HH
-
 /// ForExprAST
 class ForExprAST : public ExprAST {
 private:
@@ -233,9 +429,15 @@ private:
 public:
   ForExprAST(std::variant<VarBindingAST*, AssignmentAST*> start, ExprAST* cond, ExprAST* step, ExprAST* body);
   Value *codegen(driver& drv) override;
+  uint32_t flatten(FlatAST& flat) override;
+  uint64_t countNodes() override;
+  std::optional<double> eval(Evaluator& ev) override;
+  ExprAST *fold(Evaluator& ev) override;
+  bool numeric() const override;
 };
 
-/// CondExpAST - Classe per la rappresentazione di operatori binari
+/// CondExpAST - Classe per la rappresentazione di operatori logici
+/// (and, or, not) e delle annotazioni likely/unlikely
 class CondExprAST : public ExprAST {
 private:
   char Op;
@@ -245,5 +447,13 @@ private:
 public:
   CondExprAST(char Op, ExprAST* LHS, ExprAST* RHS);
   CondExprAST(char Op, ExprAST* RHS);
+  int branchHint() const override;
   Value *codegen(driver& drv) override;
+  uint32_t flatten(FlatAST& flat) override;
+  uint64_t countNodes() override;
+  std::optional<double> eval(Evaluator& ev) override;
+  ExprAST *fold(Evaluator& ev) override;
+  bool numeric() const override;
 };
+
+#endif // ! DRIVER_HH
@@ -0,0 +1,447 @@
+#include "eval.hpp"
+#include <climits>
+#include <cmath>
+
+/************************* Valutatore *************************/
+Evaluator::Evaluator(uint64_t budget): budget(budget), fuel(budget),
+  maxdepth(DefaultDepth), depth(0), globals(nullptr), limit(UINT_MAX),
+  compiled(nullptr), toplevel(false) {};
+
+// Ogni nodo visitato consuma un passo: anche un ciclo infinito o una
+// ricorsione senza fine terminano (con un fallimento) in tempo limitato.
+// Dentro constant, senza variabili locali né chiamate in corso, il valore
+// di un nodo dipende solo dal nodo stesso e viene calcolato una volta sola
+std::optional<double> Evaluator::eval(ExprAST *E) {
+  if (!E || !fuel)
+    return std::nullopt;
+  bool memo = toplevel && vars.empty() && !depth;
+  if (memo) {
+    auto it = known.find(E);
+    if (it != known.end())
+      return it->second;
+  }
+  fuel--;
+  std::optional<double> res = E->eval(*this);
+  if (memo)
+    known[E] = res;
+  return res;
+};
+
+std::optional<double> Evaluator::call(const std::string& name, const std::vector<double>& args) {
+  auto F = functions.find(name);
+  if (F == functions.end() || !F->second || !visible(name) || depth >= maxdepth)
+    return std::nullopt;
+  if (compiled) {
+    const Function *fn = compiled->getFunction(name);
+    if (!fn || fn->empty())
+      return std::nullopt;
+  }
+  depth++;
+  std::optional<double> res = F->second->apply(*this, args);
+  depth--;
+  return res;
+};
+
+bool Evaluator::visible(const std::string& name) const {
+  auto it = order.find(name);
+  return it != order.end() && it->second < limit;
+};
+
+std::optional<double> Evaluator::bind(const std::string& name, double val) {
+  std::optional<double> outer;
+  auto it = vars.find(name);
+  if (it != vars.end())
+    outer = it->second;
+  vars[name] = val;
+  return outer;
+};
+
+void Evaluator::unbind(const std::string& name, std::optional<double> outer) {
+  if (outer)
+    vars[name] = *outer;
+  else
+    vars.erase(name);
+};
+
+// Valore di E senza variabili locali, con il carburante residuo
+std::optional<double> Evaluator::constant(ExprAST *E) {
+  vars.clear();
+  depth = 0;
+  toplevel = true;
+  std::optional<double> res = eval(E);
+  toplevel = false;
+  return res;
+};
+
+ExprAST *Evaluator::fold(ExprAST *E) {
+  return E ? E->fold(*this) : E;
+};
+
+// Chiamata dai metodi fold dopo il folding dei figli
+ExprAST *Evaluator::replace(ExprAST *E) {
+  if (!E->numeric())
+    return E;
+  std::optional<double> val = constant(E);
+  if (!val)
+    return E;
+  NumberExprAST *N = new NumberExprAST(*val);
+  N->setLocation(E->getLocation());
+  return N;
+};
+
+/************************* Valutazione dei nodi *************************/
+// La semantica è quella del codice generato da codegen: in particolare
+// un ciclo vale 0 e un assegnamento il valore assegnato
+
+std::optional<double> NumberExprAST::eval(Evaluator& ev) {
+  return Val;
+};
+
+std::optional<double> VariableExprAST::eval(Evaluator& ev) {
+  auto it = ev.vars.find(Name);
+  if (it != ev.vars.end())
+    return it->second;
+  if (ev.globals && ev.visible(Name)) {
+    auto g = ev.globals->find(Name);
+    if (g != ev.globals->end())
+      return g->second;
+  }
+  return std::nullopt;
+};
+
+// I confronti sono quelli di BinaryOp: "minore" e "uguale" oppure non
+// ordinati (con un operando NaN sono veri)
+std::optional<double> BinaryExprAST::eval(Evaluator& ev) {
+  if (!LHS) {
+    std::optional<double> R = ev.eval(RHS);
+    if (!R || Ope != '-')
+      return std::nullopt;
+    return -*R;
+  }
+  std::optional<double> L = ev.eval(LHS);
+  if (!L)
+    return L;
+  std::optional<double> R = ev.eval(RHS);
+  if (!R)
+    return R;
+  switch (Ope) {
+  case '+':
+    return *L + *R;
+  case '-':
+    return *L - *R;
+  case '*':
+    return *L * *R;
+  case '/':
+    return *L / *R;
+  case '<':
+    return !(*L >= *R) ? 1.0 : 0.0;
+  case '=':
+    return *L == *R || std::isnan(*L) || std::isnan(*R) ? 1.0 : 0.0;
+  default:
+    return std::nullopt;
+  }
+};
+
+std::optional<double> CallExprAST::eval(Evaluator& ev) {
+  if (IsVectorBuiltin(Callee))
+    return std::nullopt;
+  std::vector<double> ArgsV;
+  for (auto arg : Args) {
+    std::optional<double> V = ev.eval(arg);
+    if (!V)
+      return V;
+    ArgsV.push_back(*V);
+  }
+  return ev.call(Callee, ArgsV);
+};
+
+std::optional<double> IfExprAST::eval(Evaluator& ev) {
+  std::optional<double> C = ev.eval(Cond);
+  if (!C)
+    return C;
+  return ev.eval(*C ? TrueExp : FalseExp);
+};
+
+std::optional<double> BlockExprAST::eval(Evaluator& ev) {
+  std::vector<std::optional<double>> Outer;
+  std::optional<double> res;
+  bool ok = true;
+  for (auto def : Def) {
+    std::optional<double> V = def->eval(ev);
+    if (!(ok = V.has_value()))
+      break;
+    Outer.push_back(ev.bind(def->getName(), *V));
+  }
+  if (ok)
+    res = ev.eval(Val);
+  for (int i=Outer.size()-1; i>=0; i--)
+    ev.unbind(Def[i]->getName(), Outer[i]);
+  return res;
+};
+
+// Valore iniziale della variabile
+std::optional<double> VarBindingAST::eval(Evaluator& ev) {
+  return ev.eval(Val);
+};
+
+std::optional<double> FunctionAST::apply(Evaluator& ev, const std::vector<double>& args) {
+  const std::vector<std::string>& Params = Proto->getArgs();
+  if (args.size() != Params.size())
+    return std::nullopt;
+  std::map<std::string, double> Frame;
+  for (unsigned i=0; i<args.size(); i++)
+    Frame[Params[i]] = args[i];
+  std::swap(Frame, ev.vars);
+  std::optional<double> res = ev.eval(Body);
+  std::swap(Frame, ev.vars);
+  return res;
+};
+
+// ++x incrementa solo variabili locali, come nel codice generato
+std::optional<double> AssignmentAST::eval(Evaluator& ev) {
+  if (Op == '+') {
+    auto it = ev.vars.find(Name);
+    if (it == ev.vars.end())
+      return std::nullopt;
+    return it->second += 1;
+  }
+  std::optional<double> V = ev.eval(Val);
+  if (!V)
+    return V;
+  auto it = ev.vars.find(Name);
+  if (it != ev.vars.end())
+    return it->second = *V;
+  if (ev.globals && ev.visible(Name)) {
+    auto g = ev.globals->find(Name);
+    if (g != ev.globals->end())
+      return g->second = *V;
+  }
+  return std::nullopt;
+};
+
+std::optional<double> StmtAST::eval(Evaluator& ev) {
+  std::optional<double> L = ev.eval(Left);
+  if (!L || !Right)
+    return L;
+  return ev.eval(Right);
+};
+
+// Il contatore introdotto con var è visibile solo nel ciclo
+std::optional<double> ForExprAST::eval(Evaluator& ev) {
+  std::string VarName;
+  std::optional<double> Outer;
+  if (std::holds_alternative<VarBindingAST*>(Start)) {
+    VarBindingAST *Binding = std::get<VarBindingAST*>(Start);
+    std::optional<double> V = Binding->eval(ev);
+    if (!V)
+      return V;
+    VarName = Binding->getName();
+    Outer = ev.bind(VarName, *V);
+  } else if (!ev.eval(std::get<AssignmentAST*>(Start)))
+    return std::nullopt;
+
+  bool ok;
+  for (;;) {
+    std::optional<double> C = ev.eval(Cond);
+    if (!(ok = C.has_value()) || !*C)
+      break;
+    if (!(ok = ev.eval(Body) && ev.eval(Step)))
+      break;
+    ev.backedge();
+  }
+  if (!VarName.empty())
+    ev.unbind(VarName, Outer);
+  if (!ok)
+    return std::nullopt;
+  return 0.0;
+};
+
+std::optional<double> CondExprAST::eval(Evaluator& ev) {
+  if (!LHS) {
+    std::optional<double> R = ev.eval(RHS);
+    if (!R)
+      return R;
+    if (Op == '!')
+      return *R ? 0.0 : 1.0;
+    if (Op == 'L' || Op == 'U')
+      return R;
+    return std::nullopt;
+  }
+  if (Op != '&' && Op != '|')
+    return std::nullopt;
+  std::optional<double> L = ev.eval(LHS);
+  if (!L)
+    return L;
+  if (Op == '&' && !*L)
+    return 0.0;
+  if (Op == '|' && *L)
+    return 1.0;
+  return ev.eval(RHS);
+};
+
+/************************* Definizioni *************************/
+// Il valore di una definizione non ha significato (0): conta che diventi
+// nota al valutatore, come avviene per il codice con codegen
+std::optional<double> SeqAST::eval(Evaluator& ev) {
+  if (first && !first->eval(ev))
+    return std::nullopt;
+  if (continuation)
+    return continuation->eval(ev);
+  return 0.0;
+};
+
+// Una funzione esterna (o già dichiarata) non è calcolabile, anche se più
+// avanti compare una definizione con lo stesso nome: codegen la rifiuterebbe
+std::optional<double> PrototypeAST::eval(Evaluator& ev) {
+  ev.functions.try_emplace(Name, nullptr);
+  ev.externs.try_emplace(Name, this);
+  ev.order.try_emplace(Name, ev.order.size());
+  return 0.0;
+};
+
+// La funzione è nota prima del corpo, che può quindi essere ricorsivo
+std::optional<double> FunctionAST::eval(Evaluator& ev) {
+  const std::string& Name = std::get<std::string>(Proto->getLexVal());
+  bool computable = !Proto->isTyped() && !IsVectorBuiltin(Name);
+  ev.functions.try_emplace(Name, computable ? this : nullptr);
+  ev.order.try_emplace(Name, ev.order.size());
+  return 0.0;
+};
+
+std::optional<double> VarGlobalAST::eval(Evaluator& ev) {
+  if (ev.globals)
+    ev.globals->try_emplace(Name, 0.0);
+  ev.order.try_emplace(Name, ev.order.size());
+  return 0.0;
+};
+
+/************************* Folding *************************/
+
+bool BinaryExprAST::numeric() const {
+  return Ope != '<' && Ope != '=';
+};
+
+bool IfExprAST::numeric() const {
+  return FalseExp && TrueExp->numeric() && FalseExp->numeric();
+};
+
+bool BlockExprAST::numeric() const {
+  return Val->numeric();
+};
+
+bool AssignmentAST::numeric() const {
+  return false;
+};
+
+bool StmtAST::numeric() const {
+  return Right ? Right->numeric() : Left->numeric();
+};
+
+bool ForExprAST::numeric() const {
+  return false;
+};
+
+bool CondExprAST::numeric() const {
+  return false;
+};
+
+RootAST *SeqAST::fold(Evaluator& ev) {
+  if (first)
+    first = first->fold(ev);
+  if (continuation)
+    continuation = continuation->fold(ev);
+  return this;
+};
+
+ExprAST *BinaryExprAST::fold(Evaluator& ev) {
+  LHS = ev.fold(LHS);
+  RHS = ev.fold(RHS);
+  return ev.replace(this);
+};
+
+ExprAST *CallExprAST::fold(Evaluator& ev) {
+  for (auto& arg : Args)
+    arg = ev.fold(arg);
+  return ev.replace(this);
+};
+
+ExprAST *IndexExprAST::fold(Evaluator& ev) {
+  Index = ev.fold(Index);
+  return this;
+};
+
+// Con una condizione costante il condizionale è sostituito dal ramo scelto
+// (un if senza else con condizione falsa resta, perché non ha valore)
+ExprAST *IfExprAST::fold(Evaluator& ev) {
+  Cond = ev.fold(Cond);
+  std::optional<double> C = ev.constant(Cond);
+  if (C && *C)
+    return ev.fold(TrueExp);
+  if (C && FalseExp)
+    return ev.fold(FalseExp);
+  TrueExp = ev.fold(TrueExp);
+  FalseExp = ev.fold(FalseExp);
+  return ev.replace(this);
+};
+
+ExprAST *BlockExprAST::fold(Evaluator& ev) {
+  for (auto def : Def)
+    def->fold(ev);
+  Val = ev.fold(Val);
+  return ev.replace(this);
+};
+
+VarBindingAST *VarBindingAST::fold(Evaluator& ev) {
+  Val = ev.fold(Val);
+  return this;
+};
+
+RootAST *PrototypeAST::fold(Evaluator& ev) {
+  eval(ev);
+  return this;
+};
+
+// Ogni definizione ha a disposizione lo stesso carburante, così che il
+// tempo di compilazione resti proporzionale alla lunghezza del programma.
+// Una definizione precedente con lo stesso nome che codegen ha rifiutato
+// (e che quindi non è nel modulo) è sostituita da questa, come in codegen.
+// Le chiamate ricorsive nel corpo non vengono calcolate: la funzione non è
+// ancora compilata
+RootAST *FunctionAST::fold(Evaluator& ev) {
+  const std::string& Name = std::get<std::string>(Proto->getLexVal());
+  if (ev.compiled && !ev.compiled->getFunction(Name))
+    ev.functions.erase(Name);
+  eval(ev);
+  ev.fuel = ev.budget;
+  ev.known.clear();
+  Body = ev.fold(Body);
+  return this;
+};
+
+ExprAST *AssignmentAST::fold(Evaluator& ev) {
+  Val = ev.fold(Val);
+  return this;
+};
+
+ExprAST *StmtAST::fold(Evaluator& ev) {
+  Left = ev.fold(Left);
+  Right = ev.fold(Right);
+  return ev.replace(this);
+};
+
+ExprAST *ForExprAST::fold(Evaluator& ev) {
+  if (std::holds_alternative<VarBindingAST*>(Start))
+    std::get<VarBindingAST*>(Start)->fold(ev);
+  else
+    std::get<AssignmentAST*>(Start)->fold(ev);
+  Cond = ev.fold(Cond);
+  Step = ev.fold(Step);
+  Body = ev.fold(Body);
+  return this;
+};
+
+ExprAST *CondExprAST::fold(Evaluator& ev) {
+  LHS = ev.fold(LHS);
+  RHS = ev.fold(RHS);
+  return this;
+};
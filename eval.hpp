@@ -0,0 +1,78 @@
+#ifndef EVAL_HPP
+#define EVAL_HPP
+/**************** C++ modules and generic data types ***********************/
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "driver.hpp"
+
+// Valutatore dell'AST: calcola il valore di un'espressione direttamente sui
+// nodi (metodi eval, in eval.cpp), senza generare codice. Valori double e
+// booleani (1 oppure 0, come i risultati dei confronti) sono entrambi
+// rappresentati da un double; i vettori non sono gestiti.
+// Una valutazione fallisce (nullopt) quando incontra qualcosa che non può
+// calcolare: una variabile o una funzione sconosciuta, una funzione esterna,
+// un vettore, oppure quando esaurisce il "carburante" (fuel, un passo per
+// ogni nodo visitato) o supera la profondità massima delle chiamate.
+// Con globals nullo le variabili globali sono sconosciute: una funzione che
+// le legge o le modifica non è calcolabile, per cui ciò che si riesce a
+// valutare è necessariamente privo di effetti collaterali.
+// Valutare una definizione (eval di FunctionAST, PrototypeAST, VarGlobalAST
+// e della sequenza SeqAST) la rende nota al valutatore.
+// Le classi derivate (l'interprete di tiered.hpp) ridefiniscono call e
+// backedge per chiamare funzioni esterne e contare chiamate e iterazioni
+class Evaluator {
+public:
+  static const uint64_t DefaultFuel = 1000000;
+  static const unsigned DefaultDepth = 500;
+
+  uint64_t budget;    // Carburante assegnato ad ogni definizione (fold)
+  uint64_t fuel;      // Carburante residuo
+  unsigned maxdepth;  // Chiamate annidate consentite
+  unsigned depth;
+  std::map<std::string, double> vars;      // Variabili locali visibili
+  std::map<std::string, double> *globals;  // Variabili globali, se note
+  // Funzioni definite fino a questo punto del programma; nullptr per le
+  // funzioni esterne (e per quelle, con tipi vettoriali, non calcolabili)
+  std::map<std::string, FunctionAST*> functions;
+  std::map<std::string, PrototypeAST*> externs;  // Funzioni esterne dichiarate
+  // Posizione nel programma di ogni definizione (funzione, funzione esterna
+  // o variabile globale): sono visibili solo quelle che precedono limit,
+  // così che, come in codegen, una funzione non usi ciò che è definito dopo
+  std::map<std::string, unsigned> order;
+  unsigned limit;
+  // Con -ffold, il modulo in costruzione: sono calcolabili solo le funzioni
+  // che vi sono già state compilate senza errori, perché una chiamata che
+  // codegen non potrebbe compilare non deve sparire dal programma
+  const Module *compiled;
+
+  explicit Evaluator(uint64_t budget = DefaultFuel);
+  virtual ~Evaluator() {};
+  std::optional<double> eval(ExprAST *E);
+  virtual std::optional<double> call(const std::string& name, const std::vector<double>& args);
+  virtual void backedge() {};  // Ad ogni iterazione di un ciclo
+  bool visible(const std::string& name) const;
+  // Definizione di una variabile locale che nasconde quella con lo stesso
+  // nome (se c'è), restituita da bind e ripristinata da unbind
+  std::optional<double> bind(const std::string& name, double val);
+  void unbind(const std::string& name, std::optional<double> outer);
+
+  // Folding (opzione -ffold): i metodi fold dei nodi sostituiscono i
+  // sottoalberi con valore double calcolabile senza variabili locali con una
+  // costante, e i condizionali con condizione costante con il ramo scelto.
+  // Il valore calcolato da constant per ciascun nodo viene ricordato (in
+  // known, per la definizione corrente): replace, chiamata su ogni nodo
+  // dopo i figli, non ne ripete la valutazione
+  std::optional<double> constant(ExprAST *E);
+  ExprAST *fold(ExprAST *E);
+  ExprAST *replace(ExprAST *E);
+  std::unordered_map<ExprAST*, std::optional<double>> known;
+private:
+  bool toplevel;  // Valutazione di constant, fuori da chiamate e blocchi
+};
+
+#endif // ! EVAL_HPP
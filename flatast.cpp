@@ -0,0 +1,251 @@
+#include "flatast.hpp"
+
+/************************* Costruzione dell'AST compatto *************************/
+FlatAST::FlatAST(RootAST* root) {
+  if (!root)
+    return;
+  uint32_t n = root->flatten(*this);
+  if (n != None)
+    top.push_back(n);
+};
+
+uint32_t FlatAST::add(FlatNode::Tag tag, uint32_t a, uint32_t b, uint32_t c, char op) {
+  nodes.push_back({tag, op, 0, 0, a, b, c});
+  return nodes.size() - 1;
+};
+
+uint32_t FlatAST::number(double val) {
+  numbers.push_back(val);
+  return numbers.size() - 1;
+};
+
+// I nomi sono memorizzati una sola volta: nodi diversi che si riferiscono
+// alla stessa variabile o funzione condividono l'indice
+uint32_t FlatAST::name(const std::string& name) {
+  auto it = nameIndex.try_emplace(name, names.size());
+  if (it.second)
+    names.push_back(name);
+  return it.first->second;
+};
+
+uint32_t FlatAST::list(const std::vector<uint32_t>& elems) {
+  uint32_t l = lists.size();
+  lists.push_back(elems.size());
+  lists.insert(lists.end(), elems.begin(), elems.end());
+  return l;
+};
+
+uint32_t FlatAST::fallback(RootAST* node) {
+  fallbacks.push_back(node);
+  return add(FlatNode::Fallback, fallbacks.size() - 1);
+};
+
+// I figli vengono aggiunti prima del padre: i nodi di una stessa funzione
+// risultano quindi contigui nel vettore
+
+// Nodo senza rappresentazione compatta: rinvio al nodo originale
+uint32_t RootAST::flatten(FlatAST& flat) {
+  return flat.fallback(this);
+};
+
+// La sequenza delle definizioni globali non è un nodo: ogni definizione
+// viene aggiunta all'elenco top
+uint32_t SeqAST::flatten(FlatAST& flat) {
+  if (first)
+    flat.top.push_back(first->flatten(flat));
+  if (continuation)
+    continuation->flatten(flat);
+  return FlatAST::None;
+};
+
+uint32_t NumberExprAST::flatten(FlatAST& flat) {
+  return flat.add(FlatNode::Number, flat.number(Val));
+};
+
+uint32_t VariableExprAST::flatten(FlatAST& flat) {
+  return flat.add(FlatNode::Variable, flat.name(Name));
+};
+
+uint32_t BinaryExprAST::flatten(FlatAST& flat) {
+  if (!LHS)
+    return Ope == '-' ? flat.add(FlatNode::Neg, RHS->flatten(flat)) : flat.fallback(this);
+  uint32_t L = LHS->flatten(flat);
+  uint32_t R = RHS->flatten(flat);
+  return flat.add(FlatNode::Binary, L, R, FlatAST::None, Ope);
+};
+
+// Costruttori e riduzioni dei vettori restano al nodo originale
+uint32_t CallExprAST::flatten(FlatAST& flat) {
+  if (IsVectorBuiltin(Callee))
+    return flat.fallback(this);
+  std::vector<uint32_t> args;
+  for (auto arg : Args)
+    args.push_back(arg->flatten(flat));
+  return flat.add(FlatNode::Call, flat.name(Callee), flat.list(args));
+};
+
+// Un if senza ramo else non ha valore: resta al nodo originale
+uint32_t IfExprAST::flatten(FlatAST& flat) {
+  if (!FalseExp)
+    return flat.fallback(this);
+  uint32_t C = Cond->flatten(flat);
+  uint32_t T = TrueExp->flatten(flat);
+  uint32_t F = FalseExp->flatten(flat);
+  return flat.add(FlatNode::If, C, T, F);
+};
+
+// Le definizioni senza valore iniziale non hanno rappresentazione compatta,
+// e con esse l'intero blocco (o ciclo) che le contiene
+uint32_t VarBindingAST::flatten(FlatAST& flat) {
+  if (!Val)
+    return FlatAST::None;
+  return flat.add(FlatNode::Binding, flat.name(Name), Val->flatten(flat));
+};
+
+uint32_t BlockExprAST::flatten(FlatAST& flat) {
+  std::vector<uint32_t> defs;
+  for (auto def : Def) {
+    defs.push_back(def->flatten(flat));
+    if (defs.back() == FlatAST::None)
+      return flat.fallback(this);
+  }
+  uint32_t body = Val->flatten(flat);
+  return flat.add(FlatNode::Block, flat.list(defs), body);
+};
+
+// I nodi compatti non hanno tipi: i prototipi (e le funzioni) con
+// parametri o risultato vettoriali restano al nodo originale, come quelli
+// che ridefiniscono un costruttore o una riduzione (errore segnalato da codegen)
+uint32_t PrototypeAST::flatten(FlatAST& flat) {
+  if (isTyped() || IsVectorBuiltin(Name))
+    return flat.fallback(this);
+  std::vector<uint32_t> params;
+  for (auto& arg : Args)
+    params.push_back(flat.name(arg));
+  return flat.add(FlatNode::Extern, flat.name(Name), flat.list(params));
+};
+
+uint32_t FunctionAST::flatten(FlatAST& flat) {
+  if (Proto->isTyped() || IsVectorBuiltin(std::get<std::string>(Proto->getLexVal())))
+    return flat.fallback(this);
+  std::vector<uint32_t> params;
+  for (auto& arg : Proto->getArgs())
+    params.push_back(flat.name(arg));
+  uint32_t body = Body->flatten(flat);
+  return flat.add(FlatNode::Function, flat.name(std::get<std::string>(Proto->getLexVal())),
+                  flat.list(params), body);
+};
+
+uint32_t VarGlobalAST::flatten(FlatAST& flat) {
+  return flat.add(FlatNode::Global, flat.name(Name));
+};
+
+uint32_t StmtAST::flatten(FlatAST& flat) {
+  uint32_t L = Left->flatten(flat);
+  uint32_t R = Right ? Right->flatten(flat) : FlatAST::None;
+  return flat.add(FlatNode::Stmt, L, R);
+};
+
+uint32_t AssignmentAST::flatten(FlatAST& flat) {
+  if (Op == '+')
+    return flat.add(FlatNode::Increment, flat.name(Name));
+  return flat.add(FlatNode::Assign, flat.name(Name), Val->flatten(flat));
+};
+
+// Solo i cicli che definiscono il proprio contatore (for (var i = ...))
+uint32_t ForExprAST::flatten(FlatAST& flat) {
+  if (!std::holds_alternative<VarBindingAST*>(Start))
+    return flat.fallback(this);
+  uint32_t S = std::get<VarBindingAST*>(Start)->flatten(flat);
+  if (S == FlatAST::None)
+    return flat.fallback(this);
+  uint32_t C = Cond->flatten(flat);
+  uint32_t St = Step->flatten(flat);
+  uint32_t B = Body->flatten(flat);
+  return flat.add(FlatNode::For, S, flat.list({C, St, B}));
+};
+
+// likely/unlikely non hanno un nodo proprio: l'annotazione viene riportata
+// sul nodo dell'operando, che è raggiungibile solo da qui
+uint32_t CondExprAST::flatten(FlatAST& flat) {
+  uint32_t n;
+  switch (Op) {
+  case 'L':
+  case 'U':
+    n = RHS->flatten(flat);
+    break;
+  case '!':
+    n = flat.add(FlatNode::Not, RHS->flatten(flat));
+    break;
+  case '&':
+  case '|': {
+    uint32_t L = LHS->flatten(flat);
+    uint32_t R = RHS->flatten(flat);
+    n = flat.add(FlatNode::Cond, L, R, FlatAST::None, Op);
+    break;
+  }
+  default:
+    return flat.fallback(this);
+  }
+  flat.nodes[n].hint = branchHint();
+  return n;
+};
+
+/************************* Visita dell'AST originale *************************/
+// Stessi nodi contati da FlatCount (bench/flatbench.cpp) sull'AST compatto:
+// le due visite differiscono solo per la rappresentazione
+
+uint64_t SeqAST::countNodes() {
+  return (first ? first->countNodes() : 0) + (continuation ? continuation->countNodes() : 0);
+};
+
+uint64_t BinaryExprAST::countNodes() {
+  return 1 + (LHS ? LHS->countNodes() : 0) + RHS->countNodes();
+};
+
+uint64_t CallExprAST::countNodes() {
+  uint64_t n = 1;
+  for (auto arg : Args)
+    n += arg->countNodes();
+  return n;
+};
+
+uint64_t IfExprAST::countNodes() {
+  return 1 + Cond->countNodes() + TrueExp->countNodes() + (FalseExp ? FalseExp->countNodes() : 0);
+};
+
+uint64_t BlockExprAST::countNodes() {
+  uint64_t n = 1;
+  for (auto def : Def)
+    n += def->countNodes();
+  return n + Val->countNodes();
+};
+
+uint64_t VarBindingAST::countNodes() {
+  return 1 + (Val ? Val->countNodes() : 0);
+};
+
+uint64_t FunctionAST::countNodes() {
+  return 1 + Body->countNodes();
+};
+
+uint64_t StmtAST::countNodes() {
+  return 1 + Left->countNodes() + (Right ? Right->countNodes() : 0);
+};
+
+uint64_t AssignmentAST::countNodes() {
+  return 1 + (Op == '+' ? 0 : Val->countNodes());
+};
+
+uint64_t ForExprAST::countNodes() {
+  uint64_t n = std::holds_alternative<VarBindingAST*>(Start)
+      ? std::get<VarBindingAST*>(Start)->countNodes()
+      : std::get<AssignmentAST*>(Start)->countNodes();
+  return 1 + n + Cond->countNodes() + Step->countNodes() + Body->countNodes();
+};
+
+uint64_t CondExprAST::countNodes() {
+  if (Op == 'L' || Op == 'U')
+    return RHS->countNodes();
+  return 1 + (LHS ? LHS->countNodes() : 0) + RHS->countNodes();
+};
@@ -0,0 +1,173 @@
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+#include "llvm/Support/Path.h"
+#include "driver.hpp"
+#include "eval.hpp"
+#include "lto.hpp"
+#include "server.hpp"
+#include "tiered.hpp"
+
+// Risultato della compilazione di un singolo file in modalità batch.
+// Codice prodotto e messaggi diagnostici vengono accumulati in memoria e
+// scritti solo al termine, nell'ordine in cui i file sono stati passati
+struct batchjob {
+  std::string file;
+  std::string output;  // IR testuale oppure, con -flto=thin, bitcode
+  std::string errors;
+  int res;
+};
+
+// Compilazione di un file con un driver "isolato": contesto, modulo,
+// builder e scanner sono del driver, per cui i worker non condividono nulla.
+// Le opzioni sono copiate dal driver usato per leggere la riga di comando
+static void compile (batchjob& job, const driver& opts, bool thinlto)
+{
+  driver drv;
+  raw_string_ostream out(job.output), diag(job.errors);
+  drv.setOptions(opts);
+  drv.out = &out;
+  drv.diag = &diag;
+  if (thinlto) {              // Il modulo viene scritto solo alla fine, come bitcode
+    drv.out = &nulls();
+    drv.emit_module = false;
+  }
+  job.res = drv.parse (job.file);
+  if (!job.res) {
+    job.res = drv.codegen();
+    if (!job.res && thinlto && !thinltocompile(drv, out))
+      job.res = 1;
+  }
+  out.flush();
+  diag.flush();
+}
+
+// Modalità batch (kcomp -j N a.k b.k ...): i file sono distribuiti fra N
+// thread; il codice di ciascun file va in un .ll omonimo (un .bc con
+// -flto=thin), mentre la diagnostica va sullo stream diagnostico (stderr),
+// sempre nell'ordine della riga di comando
+static int batch (std::vector<batchjob>& jobs, unsigned nthreads, const driver& opts,
+                  bool thinlto)
+{
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for (unsigned t=0; t<nthreads && t<jobs.size(); t++)
+    workers.emplace_back([&]() {
+      for (size_t i = next++; i < jobs.size(); i = next++)
+        compile (jobs[i], opts, thinlto);
+    });
+  for (auto& w : workers)
+    w.join();
+
+  int res = 0;
+  for (auto& job : jobs) {
+    if (!job.errors.empty())
+      *opts.diag << job.file << ":\n" << job.errors;
+    if (job.res) {
+      res = 1;
+      continue;
+    }
+    SmallString<128> outfile(job.file);
+    sys::path::replace_extension(outfile, thinlto ? "bc" : "ll");
+    if (!opts.writeFile(outfile.c_str(), job.output))
+      res = 1;
+  }
+  return res;
+}
+
+// Esecuzione di kcomp con gli argomenti args (esclusi il nome del programma
+// e -server). La usano sia main sia il compile server, che le passa un
+// driver con sorgenti, stream e file prodotti in memoria
+static int run (driver& drv, const std::vector<std::string>& args)
+{
+  std::vector<batchjob> jobs;
+  std::vector<std::string> exports;
+  std::string outfile;
+  std::string entry;
+  unsigned tier = TieredEngine::DefaultThreshold;
+  unsigned nthreads = 0;
+  enum { NOLTO, FULLLTO, THINLTO } lto = NOLTO;
+  size_t i = 0;
+  while (i<args.size()) {
+    if (args[i] == std::string ("-p"))
+      drv.trace_parsing = true;  // Abilita tracce debug nel parser
+    else if (args[i] == std::string ("-s"))
+      drv.trace_scanning = true; // Abilita tracce debug nello scanner
+    else if (args[i] == std::string ("-g")) {
+      drv.debug_info = true;     // Informazioni di debug DWARF
+      drv.emit_module = true;    // (il modulo è emesso per intero alla fine)
+    } else if (args[i] == std::string ("-finstrument")) {
+      drv.instrument = true;     // Profiling di funzioni e cicli (runtime kprof)
+      drv.emit_module = true;
+    } else if (args[i].compare(0, 13, "-finstrument=") == 0) {
+      drv.instrument = true;     // (solo funzioni di almeno N istruzioni IR)
+      drv.instrument_min = strtoul(args[i].c_str() + 13, nullptr, 10);
+      drv.emit_module = true;
+    } else if (args[i] == std::string ("-fssa"))
+      drv.ssa = true;            // Variabili locali in registri SSA, senza alloca
+    else if (args[i] == std::string ("-ffold"))
+      drv.fold = Evaluator::DefaultFuel; // Folding delle espressioni costanti
+    else if (args[i].compare(0, 7, "-ffold=") == 0)
+      drv.fold = std::max(1ull, strtoull(args[i].c_str() + 7, nullptr, 10)); // (N passi per definizione)
+    else if (args[i] == std::string ("-run") && i+1<args.size()) {
+      // Il programma non può girare nel compile server, condiviso fra i
+      // client e senza limiti di tempo (kcompc esegue direttamente kcomp)
+      if (drv.sources) {
+        *drv.diag << "-run non è disponibile con il compile server\n";
+        return 1;
+      }
+      entry = args[++i];         // Esecuzione a livelli di entry() (tiered.hpp)
+    }
+    else if (args[i].compare(0, 7, "-ftier=") == 0)
+      tier = strtoul(args[i].c_str() + 7, nullptr, 10); // Soglia di compilazione (0: solo interprete)
+    else if (args[i] == std::string ("-j") && i+1<args.size()) {
+      nthreads = std::max(1, atoi(args[++i].c_str())); // Compilazione batch in parallelo
+    } else if (args[i] == std::string ("-flto"))
+      lto = FULLLTO;             // Collegamento e ottimizzazione di tutti i file
+    else if (args[i] == std::string ("-flto=thin"))
+      lto = THINLTO;             // Bitcode con sommario ThinLTO per ogni file
+    else if (args[i] == std::string ("-export") && i+1<args.size())
+      exports.push_back(args[++i]); // Punto di ingresso da non rendere interno
+    else if (args[i] == std::string ("-o") && i+1<args.size())
+      outfile = args[++i];       // Uscita di -flto (default stderr)
+    else if (nthreads || lto)
+      jobs.push_back({args[i], "", "", 0});
+    else if (!drv.parse (args[i])) { // Parsing e creazione dell'AST
+      if (entry.empty()) {
+        if (drv.codegen())           // Visita AST e generazione dell'IR (su stderr)
+          return 1;
+      } else if (execute (drv, entry, tier))
+        return 1;                    // oppure esecuzione del programma
+    } else return 1;
+    i++;
+  };
+  if (lto == FULLLTO) {
+    std::vector<std::string> files;
+    for (auto& job : jobs)
+      files.push_back(job.file);
+    return ltolink (files, exports, drv, outfile);
+  }
+  if (nthreads || lto == THINLTO)
+    return batch (jobs, std::max(nthreads, 1u), drv, lto == THINLTO);
+  return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  std::vector<std::string> args(argv + 1, argv + argc);
+  // kcomp -server [socket] [-j N]: compile server con N worker (si veda
+  // server.hpp); le richieste arrivano da kcompc
+  if (!args.empty() && args[0] == "-server") {
+    std::string path = defaultSocketPath();
+    unsigned nworkers = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i=1; i<args.size(); i++)
+      if (args[i] == "-j" && i+1<args.size())
+        nworkers = std::max(1, atoi(args[++i].c_str()));
+      else
+        path = args[i];
+    return serve (path, nworkers, run);
+  }
+  driver drv;
+  return run (drv, args);
+}
@@ -0,0 +1,103 @@
+// Client del compile server: ha la stessa riga di comando di kcomp, di cui
+// riproduce il comportamento. I file sorgente vengono letti qui e spediti
+// al server (kcomp -server) insieme agli argomenti; la risposta contiene
+// codice di uscita, ciò che kcomp avrebbe scritto su stderr e i file
+// prodotti, che vengono scritti nella directory corrente del client.
+// Il socket è quello di default o quello indicato dalla variabile
+// d'ambiente KCOMP_SERVER; se nessun server è in ascolto, o con -run (il
+// programma va eseguito nel processo del client, non in quello del
+// server), viene eseguito direttamente kcomp (quello nella stessa
+// directory di kcompc).
+// Non usa LLVM: l'avvio costa quanto quello di un programma C minimo
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "protocol.hpp"
+
+static int connectServer (const std::string& path)
+{
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path))
+    return -1;
+  strcpy(addr.sun_path, path.c_str());
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd >= 0 && connect(fd, (sockaddr*) &addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int
+main (int argc, char *argv[])
+{
+  bool local = false;
+  for (int i=1; i<argc; i++)
+    local |= !strcmp(argv[i], "-run");
+  const char *env = getenv("KCOMP_SERVER");
+  int fd = local ? -1 : connectServer(env && *env ? env : defaultSocketPath());
+  if (fd < 0) {
+    std::string self(argv[0]);
+    size_t slash = self.rfind('/');
+    std::string kcomp = slash == std::string::npos ? "kcomp" : self.substr(0, slash + 1) + "kcomp";
+    argv[0] = const_cast<char*>(kcomp.c_str());
+    execvp(argv[0], argv);
+    perror(argv[0]);
+    return 1;
+  }
+
+  // Opzioni di kcomp seguite da un parametro: tutti gli altri argomenti
+  // che non iniziano con '-' sono file sorgente, e "-" è lo standard
+  // input, che viene letto qui e spedito come un file di nome "-"
+  const std::set<std::string> withparam = {"-j", "-export", "-o", "-run"};
+  std::string msg;
+  std::map<std::string, std::string> sources;
+  putU32(msg, argc - 1);
+  for (int i=1; i<argc; i++) {
+    putString(msg, argv[i]);
+    if (withparam.count(argv[i]) && i+1<argc)
+      putString(msg, argv[++i]);
+    else if (!strcmp(argv[i], "-"))
+      sources["-"].assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+    else if (argv[i][0] != '-') {
+      // Un file illeggibile non viene spedito: il server prova ad aprirlo
+      // (a partire dalla directory del client) e ne segnala l'errore come kcomp
+      std::ifstream in(argv[i], std::ios::binary);
+      if (in)
+        sources[argv[i]].assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+  }
+  putFiles(msg, sources);
+  char cwd[PATH_MAX];
+  putString(msg, getcwd(cwd, sizeof(cwd)) ? cwd : "");
+  if (!sendAll(fd, msg)) {
+    perror("kcompc");
+    return 1;
+  }
+
+  uint32_t res;
+  std::string log;
+  std::map<std::string, std::string> outputs;
+  if (!getU32(fd, res) || !getString(fd, log) || !getFiles(fd, outputs)) {
+    std::cerr << "kcompc: risposta incompleta dal server\n";
+    return 1;
+  }
+  close(fd);
+  std::cerr << log;
+  for (auto& f : outputs) {
+    std::ofstream os(f.first, std::ios::binary);
+    if (!(os << f.second)) {
+      std::cerr << "cannot open " << f.first << '\n';
+      res = 1;
+    }
+  }
+  return res;
+}
@@ -0,0 +1,149 @@
+#include "lto.hpp"
+#include "llvm/Analysis/ModuleSummaryAnalysis.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Transforms/IPO/GlobalDCE.h"
+#include "llvm/Transforms/IPO/Internalize.h"
+#include <mutex>
+#include <set>
+
+std::unique_ptr<TargetMachine> createHostTargetMachine(std::string& err) {
+  // L'inizializzazione dei target è globale: va fatta una sola volta,
+  // anche quando più thread compilano in parallelo
+  static std::once_flag init;
+  std::call_once(init, []() {
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+  });
+  std::string triple = sys::getDefaultTargetTriple();
+  const Target *T = TargetRegistry::lookupTarget(triple, err);
+  if (!T)
+    return nullptr;
+  // Codice rilocabile, perché i programmi vengono collegati come PIE
+  return std::unique_ptr<TargetMachine>(T->createTargetMachine(triple,
+      sys::getHostCPUName(), "", TargetOptions(), Reloc::PIC_));
+}
+
+// Triple e data layout del modulo devono corrispondere al target usato
+// per ottimizzare, altrimenti le analisi dei costi non sono affidabili
+static void setHostTarget(Module& M, TargetMachine& TM) {
+  M.setTargetTriple(TM.getTargetTriple().str());
+  M.setDataLayout(TM.createDataLayout());
+}
+
+void runPipeline(Module& M, TargetMachine& TM,
+                 function_ref<ModulePassManager(PassBuilder&)> build) {
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+  PassBuilder PB(&TM);
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+  ModulePassManager MPM = build(PB);
+  MPM.run(M, MAM);
+}
+
+int ltolink(const std::vector<std::string>& files, const std::vector<std::string>& exports,
+            const driver& opts, const std::string& outfile) {
+  if (exports.empty()) {
+    *opts.diag << "-flto: nessun simbolo esportato (-export), il programma sarebbe vuoto\n";
+    return 1;
+  }
+  std::string err;
+  std::unique_ptr<TargetMachine> TM = createHostTargetMachine(err);
+  if (!TM) {
+    *opts.diag << err << "\n";
+    return 1;
+  }
+
+  // Il Linker richiede che tutti i moduli appartengano allo stesso contesto
+  LLVMContext context;
+  auto linked = std::make_unique<Module>("Kaleidoscope", context);
+  setHostTarget(*linked, *TM);
+  Linker L(*linked);
+  for (auto& f : files) {
+    driver drv(&context);
+    drv.setOptions(opts);
+    drv.out = &nulls();        // Nessuna emissione per singola definizione
+    drv.diag = opts.diag;
+    drv.emit_module = false;
+    if (drv.parse(f) || drv.codegen())
+      return 1;
+    // Il modulo passa dal driver al Linker
+    std::unique_ptr<Module> M(drv.module);
+    drv.module = nullptr;
+    M->setSourceFileName(f);
+    setHostTarget(*M, *TM);
+    if (verifyModule(*M, opts.diag))
+      return 1;
+    if (L.linkInModule(std::move(M))) {
+      *opts.diag << f << ": errore nel collegamento dei moduli\n";
+      return 1;
+    }
+  }
+
+  // Solo i punti di ingresso restano visibili all'esterno: tutto il resto
+  // diventa interno e può quindi essere inlined o eliminato se inutilizzato.
+  // Ognuno deve essere definito in uno dei file, altrimenti il risultato
+  // sarebbe un modulo privo di quel simbolo
+  std::set<std::string> keep(exports.begin(), exports.end());
+  for (auto& name : keep) {
+    GlobalValue *GV = linked->getNamedValue(name);
+    if (!GV || GV->isDeclaration()) {
+      *opts.diag << "-export " << name << ": simbolo non definito in nessun file\n";
+      return 1;
+    }
+  }
+  internalizeModule(*linked, [&](const GlobalValue& GV) {
+    return keep.count(GV.getName().str()) > 0;
+  });
+  runPipeline(*linked, *TM, [](PassBuilder& PB) {
+    ModulePassManager MPM;
+    MPM.addPass(GlobalDCEPass());
+    MPM.addPass(PB.buildLTODefaultPipeline(OptimizationLevel::O2, nullptr));
+    return MPM;
+  });
+
+  if (outfile.empty()) {
+    linked->print(*opts.out, nullptr);
+    return 0;
+  }
+  std::string buf;
+  raw_string_ostream os(buf);
+  if (StringRef(outfile).endswith(".bc"))
+    WriteBitcodeToFile(*linked, os);
+  else
+    linked->print(os, nullptr);
+  os.flush();
+  return opts.writeFile(outfile, buf) ? 0 : 1;
+}
+
+bool thinltocompile(driver& drv, raw_ostream& os) {
+  std::string err;
+  std::unique_ptr<TargetMachine> TM = createHostTargetMachine(err);
+  if (!TM) {
+    *drv.diag << err << "\n";
+    return false;
+  }
+  // Il nome del file sorgente distingue i simboli interni di moduli diversi
+  // nei GUID del sommario
+  drv.module->setSourceFileName(drv.file);
+  setHostTarget(*drv.module, *TM);
+  if (verifyModule(*drv.module, drv.diag))
+    return false;
+  runPipeline(*drv.module, *TM, [](PassBuilder& PB) {
+    return PB.buildThinLTOPreLinkDefaultPipeline(OptimizationLevel::O2);
+  });
+  ProfileSummaryInfo PSI(*drv.module);
+  ModuleSummaryIndex Index = buildModuleSummaryIndex(*drv.module, nullptr, &PSI);
+  WriteBitcodeToFile(*drv.module, os, false, &Index);
+  return true;
+}
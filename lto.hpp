@@ -0,0 +1,37 @@
+#ifndef LTO_HPP
+#define LTO_HPP
+/********************* Target and optimization modules **********************/
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Target/TargetMachine.h"
+/**************** C++ modules and generic data types ***********************/
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "driver.hpp"
+
+// TargetMachine per la macchina su cui gira il compilatore: serve alle
+// ottimizzazioni (costi delle istruzioni, vettorizzazione) e a fissare
+// triple e data layout dei moduli. Restituisce nullptr (e il motivo in err)
+// se il target nativo non è disponibile
+std::unique_ptr<TargetMachine> createHostTargetMachine(std::string& err);
+
+// Esegue sul modulo la pipeline costruita da build, con le analisi del target
+void runPipeline(Module& M, TargetMachine& TM,
+                 function_ref<ModulePassManager(PassBuilder&)> build);
+
+// LTO completo: i file vengono compilati in un unico contesto, i moduli
+// collegati con llvm::Linker, tutti i simboli tranne quelli in exports resi
+// interni, eliminati quelli non raggiungibili (global DCE) e il risultato
+// ottimizzato con la pipeline LTO. L'uscita va su outfile (bitcode se
+// termina con .bc, altrimenti IR testuale) o, se vuoto, su opts.out
+int ltolink(const std::vector<std::string>& files, const std::vector<std::string>& exports,
+            const driver& opts, const std::string& outfile);
+
+// ThinLTO: il modulo del driver (già generato) viene ottimizzato con la
+// pipeline pre-link e scritto come bitcode con il sommario per la
+// ThinLTO, così che il linker (ad esempio lld con -flto=thin) possa
+// importare e ottimizzare fra file in parallelo
+bool thinltocompile(driver& drv, raw_ostream& os);
+
+#endif // ! LTO_HPP
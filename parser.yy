@@ -28,6 +28,7 @@
   class AssignmentAST;
   class ForExprAST;
   class CondExprAST;
+  class IndexExprAST;
 }
 
 // The parsing context.
@@ -39,7 +40,16 @@
 %define parse.error verbose
 
 %code {
+# include <sstream>
 # include "driver.hpp"
+
+// Annota un nodo dell'AST con la sua posizione nel sorgente
+// (usata per le informazioni di debug) e lo restituisce
+template <typename T>
+T* located (T* node, const yy::location& l) {
+  node->setLocation(l);
+  return node;
+}
 }
 
 %define api.token.prefix {TOK_}
@@ -71,6 +81,8 @@
   AND        "and"
   OR         "or"
   NOT        "not"
+  LIKELY     "likely"
+  UNLIKELY   "unlikely"
   LSQBR      "["
   RSQBR      "]"
 ;
@@ -86,11 +98,13 @@
 %type <ExprAST*> idexp
 %type <ExprAST*> expif
 %type <ExprAST*> condexp
+%type <ExprAST*> condterm
 %type <std::vector<ExprAST*>> optexp
 %type <std::vector<ExprAST*>> explist
 %type <PrototypeAST*> external
 %type <PrototypeAST*> proto
-%type <std::vector<std::string>> idseq
+%type <std::vector<std::pair<std::string,std::string>>> idseq
+%type <std::string> typeopt
 %type <std::vector<VarBindingAST*>> vardefs
 %type <VarBindingAST*> binding
 %type <StmtAST*> stmts
@@ -120,20 +134,27 @@ top:
 | globalvar             { $$ = $1; };
 
 definition:
-  "def" proto block       { $$ = new FunctionAST($2,$3); $2->noemit(); };
+  "def" proto block       { $$ = located(new FunctionAST($2,$3), @1); $2->noemit(); };
 
 external:
   "extern" proto        { $$ = $2; };
 
+// I parametri e il risultato possono avere un tipo (":vec4"), double se omesso
 proto:
-  "id" "(" idseq ")"    { $$ = new PrototypeAST($1,$3);  };
+  "id" "(" idseq ")" typeopt  { std::vector<std::string> args, types;
+                                for (auto& p : $3) { args.push_back(p.first); types.push_back(p.second); }
+                                $$ = located(new PrototypeAST($1,args,types,$5), @1);  };
+
+typeopt:
+  %empty                { $$ = ""; }
+| ":" "id"              { $$ = $2; };
 
 globalvar:
-  "global" "id"         { $$ = new VarGlobalAST($2); };
+  "global" "id"         { $$ = located(new VarGlobalAST($2), @2); };
 
 idseq:
-  %empty                { std::vector<std::string> args; $$ = args; }
-| "id" idseq            { $2.insert($2.begin(),$1); $$ = $2; };
+  %empty                { std::vector<std::pair<std::string,std::string>> args; $$ = args; }
+| "id" typeopt idseq    { $3.insert($3.begin(),{$1,$2}); $$ = $3; };
 
 %left ":" "?";
 %left "<" "==";
@@ -142,8 +163,8 @@ idseq:
 %left "and" "or" "not";
 
 stmts:
-  stmt                  { $$ = new StmtAST($1, nullptr); }
-| stmt ";" stmts        { $$ = new StmtAST($1, $3); };
+  stmt                  { $$ = located(new StmtAST($1, nullptr), @1); }
+| stmt ";" stmts        { $$ = located(new StmtAST($1, $3), @1); };
 
 stmt:
   assignment            { $$ = $1; }
@@ -155,64 +176,70 @@ stmt:
 %right ")" "else";
 
 ifstmt:
-  "if" "(" condexp ")" stmt     { $$ = new IfExprAST($3, $5, nullptr);}
-| "if" "(" condexp ")" stmt "else" stmt  {$$ = new IfExprAST($3, $5, $7);};
+  "if" "(" condexp ")" stmt     { $$ = located(new IfExprAST($3, $5, nullptr), @1);}
+| "if" "(" condexp ")" stmt "else" stmt  {$$ = located(new IfExprAST($3, $5, $7), @1);};
 
 forstmt:
-  "for" "(" init ";" condexp ";" assignment ")" stmt    {$$ = new ForExprAST($3, $5, $7, $9); };
+  "for" "(" init ";" condexp ";" assignment ")" stmt    {$$ = located(new ForExprAST($3, $5, $7, $9), @1); };
 
 init:
   binding               { $$ = $1; }
 | assignment            { $$ = $1; };
 
 assignment:
-  "id" "=" exp          { $$ = new AssignmentAST($1, $3); };
-| "++" "id"              { $$ = new AssignmentAST($2, '+'); };
+  "id" "=" exp          { $$ = located(new AssignmentAST($1, $3), @1); };
+| "++" "id"              { $$ = located(new AssignmentAST($2, '+'), @1); };
 
 
 exp:
-  exp "+" exp           { $$ = new BinaryExprAST('+',$1,$3); }
-| exp "-" exp           { $$ = new BinaryExprAST('-',$1,$3); }
-| exp "*" exp           { $$ = new BinaryExprAST('*',$1,$3); }
-| exp "/" exp           { $$ = new BinaryExprAST('/',$1,$3); }
-| "-" exp               { $$ = new BinaryExprAST('-',nullptr,$2); }
+  exp "+" exp           { $$ = located(new BinaryExprAST('+',$1,$3), @2); }
+| exp "-" exp           { $$ = located(new BinaryExprAST('-',$1,$3), @2); }
+| exp "*" exp           { $$ = located(new BinaryExprAST('*',$1,$3), @2); }
+| exp "/" exp           { $$ = located(new BinaryExprAST('/',$1,$3), @2); }
+| "-" exp               { $$ = located(new BinaryExprAST('-',nullptr,$2), @1); }
 | idexp                 { $$ = $1; }
 | "(" exp ")"           { $$ = $2; }
-| "number"              { $$ = new NumberExprAST($1); }
+| "number"              { $$ = located(new NumberExprAST($1), @1); }
 | expif                 { $$ = $1; }
 
 block:
-  "{" stmts "}"         { $$ = new BlockExprAST({}, $2); } 
-|  "{" vardefs ";" stmts "}"  { $$ = new BlockExprAST($2, $4); }; 
+  "{" stmts "}"         { $$ = located(new BlockExprAST({}, $2), @1); } 
+|  "{" vardefs ";" stmts "}"  { $$ = located(new BlockExprAST($2, $4), @1); }; 
   
 vardefs:
   binding                 { std::vector<VarBindingAST*> definitions; definitions.push_back($1); $$ = definitions; }
 | vardefs ";" binding     { $1.push_back($3); $$ = $1; };
                             
 binding:
-  "var" "id" initexp      { $$ = new VarBindingAST($2,$3); }
+  "var" "id" initexp      { $$ = located(new VarBindingAST($2,$3), @2); }
 
 initexp:
   %empty                 { $$ = nullptr; }
 | "=" exp                { $$ = $2; };
 
 expif:
-  condexp "?" exp ":" exp { $$ = new IfExprAST($1,$3,$5); };
+  condexp "?" exp ":" exp { $$ = located(new IfExprAST($1,$3,$5), @2); };
 
 condexp:
-  relexp                  { $$ = $1; }
-| relexp "and" condexp    { $$ = new CondExprAST('&', $1, $3); }
-| relexp "or" condexp     { $$ = new CondExprAST('|', $1, $3); }
-| "not" condexp           { $$ = new CondExprAST('!', $2); }
+  condterm                { $$ = $1; }
+| condterm "and" condexp  { $$ = located(new CondExprAST('&', $1, $3), @2); }
+| condterm "or" condexp   { $$ = located(new CondExprAST('|', $1, $3), @2); }
+| "not" condexp           { $$ = located(new CondExprAST('!', $2), @1); }
 | "(" condexp ")"         { $$ = $2; };
 
+condterm:
+  relexp                     { $$ = $1; }
+| "likely" "(" condexp ")"   { $$ = located(new CondExprAST('L', $3), @1); }
+| "unlikely" "(" condexp ")" { $$ = located(new CondExprAST('U', $3), @1); };
+
 relexp:
-  exp "<" exp           { $$ = new BinaryExprAST('<',$1,$3); }
-| exp "==" exp          { $$ = new BinaryExprAST('=',$1,$3); };
+  exp "<" exp           { $$ = located(new BinaryExprAST('<',$1,$3), @2); }
+| exp "==" exp          { $$ = located(new BinaryExprAST('=',$1,$3), @2); };
 
 idexp:
-  "id"                  { $$ = new VariableExprAST($1); }
-| "id" "(" optexp ")"   { $$ = new CallExprAST($1,$3); }
+  "id"                  { $$ = located(new VariableExprAST($1), @1); }
+| "id" "(" optexp ")"   { $$ = located(new CallExprAST($1,$3), @1); }
+| "id" "[" exp "]"      { $$ = located(new IndexExprAST(located(new VariableExprAST($1), @1), $3), @2); }
 
 optexp:
   %empty                { std::vector<ExprAST*> args; $$ = args; }
@@ -227,5 +254,9 @@ explist:
 void
 yy::parser::error (const location_type& l, const std::string& m)
 {
-  std::cerr << l << ": " << m << '\n';
+  // I messaggi vanno sullo stream diagnostico del driver, non su std::cerr,
+  // così che in compilazione parallela restino separati file per file
+  std::ostringstream msg;
+  msg << l << ": " << m << '\n';
+  *drv.diag << msg.str();
 }
\ No newline at end of file
@@ -0,0 +1,97 @@
+#ifndef PROTOCOL_HPP
+#define PROTOCOL_HPP
+// Protocollo fra il client kcompc e il compile server (kcomp -server),
+// su un socket Unix locale. Non dipende da LLVM, così che il client resti
+// un eseguibile piccolo e veloce da avviare.
+//
+// Tutti i valori sono interi a 32 bit (nell'ordine dei byte della macchina,
+// perché client e server girano sulla stessa) e stringhe, precedute dalla
+// loro lunghezza.
+//   richiesta: numero di argomenti, argomenti (come per kcomp),
+//              numero di file, coppie (nome, contenuto), directory
+//              corrente del client (per i percorsi relativi)
+//   risposta:  codice di uscita di kcomp, diagnostica e codice emesso
+//              (ciò che kcomp scrive su stderr), numero di file prodotti,
+//              coppie (nome, contenuto)
+#include <cerrno>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// Socket di default, uno per utente
+inline std::string defaultSocketPath() {
+  return "/tmp/kcomp-" + std::to_string(getuid()) + ".sock";
+}
+
+// Messaggio in costruzione: viene spedito con una sola write
+inline void putU32(std::string& msg, uint32_t v) {
+  msg.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+inline void putString(std::string& msg, const std::string& s) {
+  putU32(msg, s.size());
+  msg += s;
+}
+
+inline void putFiles(std::string& msg, const std::map<std::string, std::string>& files) {
+  putU32(msg, files.size());
+  for (auto& f : files) {
+    putString(msg, f.first);
+    putString(msg, f.second);
+  }
+}
+
+inline bool sendAll(int fd, const std::string& msg) {
+  for (size_t done = 0; done < msg.size(); ) {
+    ssize_t n = write(fd, msg.data() + done, msg.size() - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    done += n;
+  }
+  return true;
+}
+
+inline bool recvAll(int fd, void *buf, size_t size) {
+  for (size_t done = 0; done < size; ) {
+    ssize_t n = read(fd, static_cast<char*>(buf) + done, size - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    done += n;
+  }
+  return true;
+}
+
+inline bool getU32(int fd, uint32_t& v) {
+  return recvAll(fd, &v, sizeof(v));
+}
+
+// Limite alla dimensione di una stringa, contro messaggi malformati
+const uint32_t MaxMessage = 1u << 30;
+
+inline bool getString(int fd, std::string& s) {
+  uint32_t size;
+  if (!getU32(fd, size) || size > MaxMessage)
+    return false;
+  s.resize(size);
+  return recvAll(fd, &s[0], size);
+}
+
+inline bool getFiles(int fd, std::map<std::string, std::string>& files) {
+  uint32_t n;
+  if (!getU32(fd, n))
+    return false;
+  for (uint32_t i=0; i<n; i++) {
+    std::string name;
+    if (!getString(fd, name) || !getString(fd, files[name]))
+      return false;
+  }
+  return true;
+}
+
+#endif // ! PROTOCOL_HPP
@@ -1,5 +1,11 @@
+%top{
+  // Buffer di input più ampio del default (16K): meno chiamate a read
+  // e meno ricariche del buffer su sorgenti di grandi dimensioni
+  # define YY_BUF_SIZE 262144
+}
 %{ /* -*- C++ -*- */
 # include <cerrno>
+# include <charconv>
 # include <climits>
 # include <cstdlib>
 # include <string>
@@ -8,7 +14,10 @@
 # include "parser.hpp"
 %}
 
-%option noyywrap nounput batch debug noinput
+%option noyywrap nounput batch noinput reentrant
+/* Il supporto alle tracce (-s) non è più fissato da %option debug ma dai
+   flag passati a flex dal Makefile: con "make FASTSCAN=1" si ottengono
+   tabelle DFA complete (-Cf) e nessun controllo di debug ad ogni match */
 
 id      [a-zA-Z][a-zA-Z_0-9]*
 fpnum   [0-9]*\.?[0-9]+([eE][-+]?[0-9]+)?
@@ -51,9 +60,11 @@ blank   [ \t]
 "["      return yy::parser::make_LSQBR     (loc);
 "]"      return yy::parser::make_RSQBR     (loc);
 
-{num}    { errno = 0;
-           double n = strtod(yytext, NULL);
-           if (! (n!=HUGE_VAL && n!=-HUGE_VAL && errno != ERANGE))
+{num}    { // from_chars non dipende dal locale né da errno ed evita
+           // la scansione della stringa terminata da zero fatta da strtod
+           double n;
+           auto res = std::from_chars(yytext, yytext + yyleng, n);
+           if (res.ec == std::errc::result_out_of_range)
            throw yy::parser::syntax_error (loc, "Float value is out of range: "
                       + std::string(yytext));
            return yy::parser::make_NUMBER(n, loc);
@@ -71,6 +82,8 @@ blank   [ \t]
 "and"    { return yy::parser::make_AND(loc); }
 "or"     { return yy::parser::make_OR(loc); }
 "not"    { return yy::parser::make_NOT(loc); }
+"likely" { return yy::parser::make_LIKELY(loc); }
+"unlikely" { return yy::parser::make_UNLIKELY(loc); }
 
 {id}     { return yy::parser::make_IDENTIFIER (yytext, loc); }
 
@@ -81,19 +94,36 @@ blank   [ \t]
 <<EOF>>  { return yy::parser::make_END (loc); }
 %%
 
-void driver::scan_begin () {
-  yy_flex_debug = trace_scanning;
+bool driver::scan_begin () {
+  // Ogni driver ha il proprio scanner: nessuno stato globale (yyin, yytext, ...)
+  // è condiviso, per cui più file possono essere analizzati in parallelo
+  yylex_init (&scanner);
+  yyset_debug (trace_scanning, scanner);
+  // Sorgente già in memoria (compile server): nessun file da aprire
+  if (source)
+    {
+      yy_scan_bytes (source->data (), source->size (), scanner);
+      return true;
+    }
+  FILE *in;
   if (file.empty () || file == "-")
-    yyin = stdin;
-  else if (!(yyin = fopen (file.c_str (), "r")))
+    in = stdin;
+  else if (!(in = fopen (path ().c_str (), "r")))
     {
-      std::cerr << "cannot open " << file << ": " << strerror(errno) << '\n';
-      exit (EXIT_FAILURE);
+      *diag << "cannot open " << file << ": " << strerror(errno) << '\n';
+      yylex_destroy (scanner);
+      scanner = nullptr;
+      return false;
     }
+  yyset_in (in, scanner);
+  return true;
 }
 
 void
 driver::scan_end ()
 {
-  fclose (yyin);
-}
\ No newline at end of file
+  if (!source)
+    fclose (yyget_in (scanner));
+  yylex_destroy (scanner);  // Libera anche il buffer di yy_scan_bytes
+  scanner = nullptr;
+}
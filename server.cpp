@@ -0,0 +1,196 @@
+#include "server.hpp"
+#include "lto.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Tempo massimo (in secondi) per ricevere un'intera richiesta e per inviare
+// la risposta: un client che non completa la richiesta, o non legge la
+// risposta, non deve occupare un worker per sempre
+const int ClientTimeout = 30;
+
+// Scadenze delle connessioni. Un timeout sulle singole read non basta: un
+// client che invia un byte ogni tanto lo rinnova ogni volta. Un thread di
+// controllo chiude quindi (shutdown) le connessioni scadute, così che le
+// read e write in corso su di esse terminino con un errore
+class deadlines {
+  std::mutex lock;
+  std::condition_variable changed;
+  std::map<int, std::chrono::steady_clock::time_point> fds;
+public:
+  void start(int fd) {
+    std::lock_guard<std::mutex> g(lock);
+    fds[fd] = std::chrono::steady_clock::now() + std::chrono::seconds(ClientTimeout);
+    changed.notify_one();
+  }
+  // Va chiamata prima di chiudere fd, il cui numero può poi essere riusato
+  void stop(int fd) {
+    std::lock_guard<std::mutex> g(lock);
+    fds.erase(fd);
+  }
+  void run() {
+    std::unique_lock<std::mutex> g(lock);
+    for (;;) {
+      if (fds.empty()) {
+        changed.wait(g);
+        continue;
+      }
+      auto first = std::min_element(fds.begin(), fds.end(),
+          [](auto& a, auto& b) { return a.second < b.second; })->second;
+      if (changed.wait_until(g, first) == std::cv_status::no_timeout)
+        continue;
+      auto now = std::chrono::steady_clock::now();
+      for (auto it = fds.begin(); it != fds.end(); )
+        if (it->second <= now) {
+          shutdown(it->first, SHUT_RDWR);
+          it = fds.erase(it);
+        } else
+          ++it;
+    }
+  }
+};
+
+// Legge la richiesta: argomenti, file e directory del client
+static bool receive (int fd, std::vector<std::string>& args,
+                     std::map<std::string, std::string>& sources, std::string& cwd)
+{
+  uint32_t argc;
+  if (!getU32(fd, argc))
+    return false;
+  for (uint32_t i=0; i<argc; i++) {
+    args.emplace_back();
+    if (!getString(fd, args.back()))
+      return false;
+  }
+  return getFiles(fd, sources) && getString(fd, cwd);
+}
+
+// Legge una richiesta, la esegue con run e invia la risposta. Ricezione
+// della richiesta e invio della risposta hanno ciascuno la propria
+// scadenza; la compilazione no
+static void handle (int fd, kcompfn run, deadlines& timer)
+{
+  std::vector<std::string> args;
+  std::map<std::string, std::string> sources, outputs;
+  driver opts;
+  timer.start(fd);
+  bool received = receive(fd, args, sources, opts.cwd);
+  timer.stop(fd);
+  if (!received)
+    return;
+
+  // Codice emesso e diagnostica vanno, come in kcomp, sullo stesso stream
+  std::string log;
+  raw_string_ostream diag(log);
+  opts.out = &diag;
+  opts.diag = &diag;
+  opts.sources = &sources;
+  opts.outputs = &outputs;
+  int res = run(opts, args);
+  diag.flush();
+
+  std::string reply;
+  putU32(reply, res);
+  putString(reply, log);
+  putFiles(reply, outputs);
+  timer.start(fd);
+  sendAll(fd, reply);
+  timer.stop(fd);
+}
+
+int serve (const std::string& path, unsigned nworkers, kcompfn run)
+{
+  // Un client che chiude la connessione non deve terminare il server
+  signal(SIGPIPE, SIG_IGN);
+
+  // I target vengono inizializzati subito, una volta per tutte le richieste
+  std::string err;
+  if (!createHostTargetMachine(err))
+    errs() << "kcomp -server: " << err << "\n";
+
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    errs() << "kcomp -server: percorso del socket troppo lungo\n";
+    return 1;
+  }
+  strcpy(addr.sun_path, path.c_str());
+  int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (s < 0) {
+    errs() << "kcomp -server: " << strerror(errno) << "\n";
+    return 1;
+  }
+  // Il socket può essere rimasto da un server terminato, e va rimosso, ma
+  // solo se nessun server vi risponde: quello attivo resterebbe altrimenti
+  // senza nuovi client
+  if (connect(s, (sockaddr*) &addr, sizeof(addr)) == 0) {
+    errs() << "kcomp -server: un server è già in ascolto su " << path << "\n";
+    return 1;
+  }
+  if (errno == ECONNREFUSED)
+    unlink(path.c_str());
+  close(s);
+  s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (s < 0 || bind(s, (sockaddr*) &addr, sizeof(addr)) < 0 || listen(s, 64) < 0) {
+    errs() << "kcomp -server: " << path << ": " << strerror(errno) << "\n";
+    return 1;
+  }
+
+  deadlines timer;
+  std::thread([&]() { timer.run(); }).detach();
+
+  std::mutex lock;
+  std::condition_variable ready, space;
+  std::deque<int> pending;
+  const size_t maxpending = 4 * nworkers;
+  std::vector<std::thread> workers;
+  for (unsigned t=0; t<nworkers; t++)
+    workers.emplace_back([&]() {
+      for (;;) {
+        int fd;
+        {
+          std::unique_lock<std::mutex> g(lock);
+          ready.wait(g, [&]() { return !pending.empty(); });
+          fd = pending.front();
+          pending.pop_front();
+        }
+        space.notify_one();
+        handle(fd, run, timer);
+        close(fd);
+      }
+    });
+
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> g(lock);
+      space.wait(g, [&]() { return pending.size() < maxpending; });
+    }
+    int fd = accept4(s, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      errs() << "kcomp -server: " << strerror(errno) << "\n";
+      break;
+    }
+    {
+      std::lock_guard<std::mutex> g(lock);
+      pending.push_back(fd);
+    }
+    ready.notify_one();
+  }
+  // I worker attendono richieste per sempre: in caso di errore il
+  // processo termina senza attenderli
+  close(s);
+  for (auto& w : workers)
+    w.detach();
+  return 1;
+}
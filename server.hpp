@@ -0,0 +1,26 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+#include <string>
+#include <vector>
+
+#include "driver.hpp"
+#include "protocol.hpp"
+
+// Funzione che esegue una compilazione con gli argomenti di kcomp, usando
+// sorgenti, stream e destinazione dei file del driver ricevuto
+typedef int (*kcompfn) (driver& drv, const std::vector<std::string>& args);
+
+// Compile server: resta in ascolto sul socket Unix path e serve le
+// richieste di kcompc con nworkers thread. Il processo (e con esso
+// l'inizializzazione dei target LLVM) sopravvive alle compilazioni, che
+// quindi non pagano il costo di avvio; ogni richiesta ha comunque il
+// proprio driver, e dunque contesto e modulo, perché un LLVMContext non
+// può essere usato da più thread. Le connessioni accettate attendono un
+// worker libero in una coda di lunghezza limitata, oltre la quale il
+// server smette di accettarne di nuove; una connessione su cui il client
+// non completa la richiesta (o la lettura della risposta) entro
+// ClientTimeout secondi viene chiusa. Non parte se un altro server è già
+// in ascolto su path. Ritorna solo in caso di errore
+int serve (const std::string& path, unsigned nworkers, kcompfn run);
+
+#endif // ! SERVER_HPP
@@ -0,0 +1,333 @@
+#include "tiered.hpp"
+#include "lto.hpp"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/Support/Format.h"
+#include <cmath>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <utility>
+
+// Chiamata di una funzione nativa (compilata o esterna) con gli argomenti
+// dell'interprete; il numero di argomenti è al più MaxNativeArgs
+static double callNative(void *p, const std::vector<double>& a) {
+  switch (a.size()) {
+  case 0:
+    return ((double (*)()) p)();
+  case 1:
+    return ((double (*)(double)) p)(a[0]);
+  case 2:
+    return ((double (*)(double, double)) p)(a[0], a[1]);
+  case 3:
+    return ((double (*)(double, double, double)) p)(a[0], a[1], a[2]);
+  case 4:
+    return ((double (*)(double, double, double, double)) p)(a[0], a[1], a[2], a[3]);
+  case 5:
+    return ((double (*)(double, double, double, double, double)) p)(a[0], a[1], a[2], a[3], a[4]);
+  default:
+    return ((double (*)(double, double, double, double, double, double)) p)(a[0], a[1], a[2], a[3], a[4], a[5]);
+  }
+}
+
+// Punto di rientro degli stub nell'interprete (il suo indirizzo è una
+// costante nel codice compilato)
+static double interpreterCallback(TieredEngine *T, uint32_t id, const double *args) {
+  return T->callback(id, args);
+}
+
+// Nessun limite al numero di passi: l'interprete esegue il programma
+TieredEngine::TieredEngine(const driver& opts, unsigned threshold):
+  Evaluator(UINT64_MAX), opts(opts), threshold(threshold), current(nullptr),
+  failed(false), stop(false) {
+  globals = &globalvals;
+  maxdepth = 10000;
+};
+
+TieredEngine::~TieredEngine() {
+  {
+    std::lock_guard<std::mutex> g(lock);
+    stop = true;
+  }
+  ready.notify_one();
+  if (worker.joinable())
+    worker.join();
+};
+
+void TieredEngine::load(RootAST *root) {
+  root->eval(*this);
+  for (auto& [name, F] : functions)
+    if (F) {
+      index[name] = entries.size();
+      entries.emplace_back();
+      Entry& E = entries.back();
+      E.name = name;
+      E.F = F;
+      E.arity = F->getProto()->getArgs().size();
+      E.hot = 0;
+      E.queued = false;
+      E.native = nullptr;
+    }
+};
+
+std::optional<double> TieredEngine::run(const std::string& entry) {
+  auto it = index.find(entry);
+  if (it == index.end() || entries[it->second].arity) {
+    *opts.diag << entry << " non è una funzione senza parametri\n";
+    return std::nullopt;
+  }
+  std::optional<double> res = call(entry, {});
+  if (!res)
+    *opts.diag << "Esecuzione di " << entry << " interrotta: "
+               << "variabile o funzione non definita (o definita più avanti), vettori "
+               << "o ricorsione troppo profonda\n";
+  return res;
+};
+
+std::optional<double> TieredEngine::call(const std::string& name, const std::vector<double>& args) {
+  if (!visible(name))
+    return std::nullopt;
+  auto it = index.find(name);
+  if (it == index.end()) {
+    // Funzione esterna, cercata fra i simboli del processo
+    auto P = externs.find(name);
+    if (P == externs.end() || P->second->getArgs().size() != args.size() ||
+        args.size() > MaxNativeArgs)
+      return std::nullopt;
+    auto X = externals.try_emplace(name, nullptr).first;
+    if (!X->second && !(X->second = dlsym(RTLD_DEFAULT, name.c_str())))
+      return std::nullopt;
+    return callNative(X->second, args);
+  }
+  Entry& E = entries[it->second];
+  if (args.size() != E.arity)
+    return std::nullopt;
+  if (void *p = E.native.load(std::memory_order_acquire)) {
+    // Un errore nell'interprete richiamato da questa chiamata (callback)
+    // la fa fallire; il flag viene azzerato, così che non resti per le
+    // chiamate successive (il chiamante, se interpretato, riceve nullopt;
+    // se nativo, callback lo imposta di nuovo)
+    double res = callNative(p, args);
+    if (std::exchange(failed, false))
+      return std::nullopt;
+    return res;
+  }
+  if (++E.hot >= threshold)
+    promote(E);
+  if (depth >= maxdepth)
+    return std::nullopt;
+  // Nel corpo sono visibili la funzione stessa e le definizioni precedenti
+  Entry *caller = current;
+  unsigned outer = std::exchange(limit, order.at(name) + 1);
+  current = &E;
+  depth++;
+  std::optional<double> res = E.F->apply(*this, args);
+  depth--;
+  current = caller;
+  limit = outer;
+  return res;
+};
+
+void TieredEngine::backedge() {
+  if (current && ++current->hot >= threshold)
+    promote(*current);
+};
+
+double TieredEngine::callback(unsigned id, const double *args) {
+  Entry& E = entries[id];
+  std::optional<double> res = call(E.name, std::vector<double>(args, args + E.arity));
+  if (!res) {
+    failed = true;
+    return NAN;
+  }
+  return *res;
+};
+
+// Il thread di compilazione parte alla prima funzione calda: un programma
+// che non ne ha non paga né il thread né la creazione del JIT
+void TieredEngine::promote(Entry& E) {
+  if (E.queued || !threshold || E.arity > MaxNativeArgs)
+    return;
+  E.queued = true;
+  {
+    std::lock_guard<std::mutex> g(lock);
+    queue.push_back(index[E.name]);
+    if (!worker.joinable())
+      worker = std::thread([this]() { work(); });
+  }
+  ready.notify_one();
+};
+
+void TieredEngine::work() {
+  if (!startJIT())
+    return;
+  for (;;) {
+    unsigned id;
+    {
+      std::unique_lock<std::mutex> g(lock);
+      ready.wait(g, [&]() { return stop || !queue.empty(); });
+      if (stop)
+        return;
+      id = queue.front();
+      queue.pop_front();
+    }
+    compile(id);
+  }
+};
+
+// Le funzioni esterne sono risolte fra i simboli del processo, le variabili
+// globali all'indirizzo del loro valore nell'interprete
+bool TieredEngine::startJIT() {
+  std::string err;
+  TM = createHostTargetMachine(err);
+  if (!TM)
+    return false;
+  auto J = orc::LLJITBuilder().create();
+  if (!J) {
+    consumeError(J.takeError());
+    return false;
+  }
+  jit = std::move(*J);
+  orc::JITDylib& JD = jit->getMainJITDylib();
+  JD.addGenerator(cantFail(orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+      jit->getDataLayout().getGlobalPrefix())));
+  orc::SymbolMap Globals;
+  for (auto& [name, val] : globalvals)
+    Globals[jit->mangleAndIntern(name)] =
+        JITEvaluatedSymbol(pointerToJITTargetAddress(&val), JITSymbolFlags::Exported);
+  return !JD.define(orc::absoluteSymbols(Globals));
+};
+
+// Genera con il codegen usuale il modulo della sola funzione id, lo
+// ottimizza e lo aggiunge al JIT. Il modulo dichiara solo ciò che precede
+// la funzione nel programma, come quello di kcomp. Se non è compilabile
+// (ad esempio perché usa vettori o chiama funzioni con tipi vettoriali)
+// resta interpretata
+void TieredEngine::compile(unsigned id) {
+  Entry& E = entries[id];
+  auto ctx = std::make_unique<LLVMContext>();
+  std::unique_ptr<Module> M;
+  {
+    driver drv(ctx.get());
+    drv.setOptions(opts);
+    drv.out = &nulls();
+    drv.diag = &nulls();
+    drv.emit_module = drv.debug_info = drv.instrument = false;
+    drv.module->setDataLayout(jit->getDataLayout());
+    drv.module->setTargetTriple(TM->getTargetTriple().str());
+    Type *D = Type::getDoubleTy(*ctx);
+    unsigned pos = order.at(E.name);
+    for (auto& [name, val] : globalvals)
+      if (order.at(name) < pos)
+        new GlobalVariable(*drv.module, D, false, GlobalValue::ExternalLinkage, nullptr, name);
+    for (auto& [name, P] : externs)
+      if (order.at(name) < pos)
+        P->codegen(drv);
+    for (auto& O : entries)
+      if (order.at(O.name) < pos)
+        O.F->getProto()->codegen(drv);
+    if (!E.F->codegen(drv))
+      return;
+    // Le funzioni chiamate già compilate sono risolte dal JIT, le altre
+    // diventano stub; le dichiarazioni inutilizzate vengono rimosse
+    for (unsigned k=0; k<entries.size(); k++) {
+      Function *F = k == id ? nullptr : drv.module->getFunction(entries[k].name);
+      if (!F)
+        continue;
+      if (F->use_empty())
+        F->eraseFromParent();
+      else if (!entries[k].native.load(std::memory_order_acquire))
+        makeStub(F, k);
+    }
+    M.reset(drv.module);
+    drv.module = nullptr;
+  }
+  if (verifyModule(*M, &nulls()))
+    return;
+  runPipeline(*M, *TM, [](PassBuilder& PB) {
+    return PB.buildPerModuleDefaultPipeline(OptimizationLevel::O2);
+  });
+  if (Error Err = jit->addIRModule(orc::ThreadSafeModule(std::move(M), std::move(ctx)))) {
+    consumeError(std::move(Err));
+    return;
+  }
+  auto Sym = jit->lookup(E.name);
+  if (!Sym) {
+    consumeError(Sym.takeError());
+    return;
+  }
+  E.native.store(Sym->toPtr<void*>(), std::memory_order_release);
+};
+
+// Corpo della dichiarazione D della funzione interpretata id: se nel
+// frattempo è stata compilata, chiama il punto di ingresso pubblicato,
+// altrimenti passa gli argomenti all'interprete
+void TieredEngine::makeStub(Function *D, unsigned id) {
+  LLVMContext& C = D->getContext();
+  IRBuilder<> B(BasicBlock::Create(C, "entry", D));
+  Type *Dbl = B.getDoubleTy();
+  FunctionType *FT = D->getFunctionType();
+  PointerType *FP = PointerType::getUnqual(FT);
+  D->setLinkage(GlobalValue::InternalLinkage);
+
+  AllocaInst *Args = B.CreateAlloca(ArrayType::get(Dbl, FT->getNumParams()), nullptr, "args");
+  Value *Slot = ConstantExpr::getIntToPtr(B.getInt64((uintptr_t) &entries[id].native),
+                                          PointerType::getUnqual(FP));
+  LoadInst *Native = B.CreateAlignedLoad(FP, Slot, Align(8), "native");
+  Native->setAtomic(AtomicOrdering::Acquire);
+  BasicBlock *NativeBB = BasicBlock::Create(C, "native", D);
+  BasicBlock *InterpBB = BasicBlock::Create(C, "interp", D);
+  B.CreateCondBr(B.CreateIsNotNull(Native), NativeBB, InterpBB);
+
+  std::vector<Value*> ArgsV;
+  for (auto& A : D->args())
+    ArgsV.push_back(&A);
+  B.SetInsertPoint(NativeBB);
+  B.CreateRet(B.CreateCall(FT, Native, ArgsV));
+
+  B.SetInsertPoint(InterpBB);
+  for (unsigned i=0; i<ArgsV.size(); i++)
+    B.CreateStore(ArgsV[i], B.CreateConstGEP2_32(Args->getAllocatedType(), Args, 0, i));
+  FunctionType *CT = FunctionType::get(Dbl, {B.getInt8PtrTy(), B.getInt32Ty(),
+                                             PointerType::getUnqual(Dbl)}, false);
+  Value *Callback = ConstantExpr::getIntToPtr(B.getInt64((uintptr_t) &interpreterCallback),
+                                              PointerType::getUnqual(CT));
+  Value *This = ConstantExpr::getIntToPtr(B.getInt64((uintptr_t) this), B.getInt8PtrTy());
+  B.CreateRet(B.CreateCall(CT, Callback, {This, B.getInt32(id),
+      B.CreateConstGEP2_32(Args->getAllocatedType(), Args, 0, 0)}));
+};
+
+// L'interprete è ricorsivo sull'AST e ogni chiamata interpretata occupa
+// più stack di una chiamata nativa: il programma viene eseguito in un
+// thread con uno stack ampio (riservato, non allocato) anziché in quello
+// principale, così che anche la profondità massima delle chiamate sia sicura
+static const size_t InterpreterStack = 256 << 20;
+
+struct execution {
+  TieredEngine *T;
+  const std::string *entry;
+  std::optional<double> res;
+};
+
+static void *runEntry(void *arg) {
+  execution *X = (execution*) arg;
+  X->res = X->T->run(*X->entry);
+  return nullptr;
+}
+
+int execute(driver& drv, const std::string& entry, unsigned threshold) {
+  TieredEngine T(drv, threshold);
+  T.load(drv.root);
+  execution X = {&T, &entry, std::nullopt};
+  pthread_attr_t attr;
+  pthread_t thread;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, InterpreterStack);
+  if (pthread_create(&thread, &attr, runEntry, &X))
+    runEntry(&X);
+  else
+    pthread_join(thread, nullptr);
+  pthread_attr_destroy(&attr);
+  if (!X.res)
+    return 1;
+  *drv.out << format("%.17g\n", *X.res);
+  return 0;
+}
@@ -0,0 +1,84 @@
+#ifndef TIERED_HPP
+#define TIERED_HPP
+/********************* JIT and target modules **********************/
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/Target/TargetMachine.h"
+/**************** C++ modules and generic data types ***********************/
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "eval.hpp"
+
+// Esecuzione a livelli (kcomp -run f): il programma parte subito,
+// interpretato sull'AST (livello 0, il valutatore di eval.hpp, senza LLVM).
+// Ogni funzione conta chiamate e iterazioni dei propri cicli: superata la
+// soglia, la funzione viene compilata da un thread in background con il
+// codegen usuale e la pipeline O2, in un modulo proprio caricato in un JIT
+// ORC (livello 1). Il punto di ingresso compilato è pubblicato nella voce
+// della funzione, da cui lo prendono sia l'interprete sia il codice
+// compilato: le chiamate passano al codice nativo non appena è pronto.
+// Nel modulo di una funzione, le funzioni chiamate ancora interpretate
+// sono sostituite da "stub" che usano il codice nativo quando c'è e
+// altrimenti rientrano nell'interprete; quelle già compilate sono chiamate
+// direttamente. Le variabili globali stanno nell'interprete e il codice
+// compilato vi accede allo stesso indirizzo.
+// Una chiamata in corso non cambia livello (non c'è sostituzione sullo
+// stack): un ciclo caldo rende nativa la funzione dalla chiamata successiva
+class TieredEngine : public Evaluator {
+public:
+  static const unsigned DefaultThreshold = 1000;
+  static const unsigned MaxNativeArgs = 6;  // Parametri di una chiamata nativa
+
+  // threshold 0: solo interprete
+  TieredEngine(const driver& opts, unsigned threshold = DefaultThreshold);
+  ~TieredEngine();
+  void load(RootAST *root);
+  std::optional<double> run(const std::string& entry);
+
+  std::optional<double> call(const std::string& name, const std::vector<double>& args) override;
+  void backedge() override;
+  // Chiamata all'interprete da parte del codice compilato
+  double callback(unsigned id, const double *args);
+
+private:
+  struct Entry {
+    std::string name;
+    FunctionAST *F;
+    unsigned arity;
+    uint64_t hot;                    // Chiamate più iterazioni
+    bool queued;                     // Già inviata al compilatore
+    std::atomic<void*> native;       // Punto di ingresso compilato
+  };
+  const driver& opts;
+  unsigned threshold;
+  std::deque<Entry> entries;         // Le voci non si spostano in memoria
+  std::map<std::string, unsigned> index;
+  std::map<std::string, double> globalvals;
+  std::map<std::string, void*> externals;  // Funzioni esterne risolte
+  Entry *current;                    // Funzione interpretata in corso
+  bool failed;                       // Errore nell'interprete sotto la chiamata nativa in corso
+
+  // Compilazione in background
+  std::thread worker;
+  std::mutex lock;
+  std::condition_variable ready;
+  std::deque<unsigned> queue;
+  bool stop;
+  std::unique_ptr<orc::LLJIT> jit;
+  std::unique_ptr<TargetMachine> TM;
+  void promote(Entry& E);
+  void work();
+  bool startJIT();
+  void compile(unsigned id);
+  void makeStub(Function *D, unsigned id);
+};
+
+// kcomp -run: esegue entry() (funzione senza parametri) del programma in
+// drv.root e ne scrive il valore su drv.out
+int execute(driver& drv, const std::string& entry, unsigned threshold);
+
+#endif // ! TIERED_HPP